@@ -0,0 +1,477 @@
+#include "./compress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "./io.h"
+#ifdef JED_ZSTD
+#include <zstd.h>
+#endif
+
+#define COMPRESS_GZIP_LEVEL 6
+#define COMPRESS_ZSTD_LEVEL 3
+
+// Tells the format apart by the magic at the start of the file
+Compress_Format compress_detect(int fd)
+{
+  unsigned char magic[4] = {0};
+  if (pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic)) {
+    return COMPRESS_NONE;
+  }
+  if (magic[0] == 0x1f && magic[1] == 0x8b) {
+    return COMPRESS_GZIP;
+  }
+  if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd) {
+    return COMPRESS_ZSTD;
+  }
+  return COMPRESS_NONE;
+}
+
+// Size of the text of the first zstd frame if its header records it,
+// 0 otherwise
+size_t compress_content_size(int fd, Compress_Format format)
+{
+#ifdef JED_ZSTD
+  unsigned char header[18] = {0};
+  const ssize_t got = pread(fd, header, sizeof(header), 0);
+  if (format != COMPRESS_ZSTD || got <= 0) {
+    return 0;
+  }
+  const unsigned long long size =
+      ZSTD_getFrameContentSize(header, (size_t)got);
+  return size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR
+             ? 0
+             : (size_t)size;
+#else
+  (void)fd;
+  (void)format;
+  return 0;
+#endif
+}
+
+// Format a file is likely in going by its name
+Compress_Format compress_format_of_path(const char* path)
+{
+  const size_t n = strlen(path);
+  if (n > 3 && strcmp(path + n - 3, ".gz") == 0) {
+    return COMPRESS_GZIP;
+  }
+  if (n > 4 && strcmp(path + n - 4, ".zst") == 0) {
+    return COMPRESS_ZSTD;
+  }
+  return COMPRESS_NONE;
+}
+
+const char* compress_format_name(Compress_Format format)
+{
+  switch (format) {
+  case COMPRESS_GZIP:
+    return "gzip";
+  case COMPRESS_ZSTD:
+    return "zstd";
+  case COMPRESS_NONE:
+    break;
+  }
+  return "none";
+}
+
+// zstd is an optional dependency, see JED_ZSTD in the Makefile
+bool compress_supported(Compress_Format format)
+{
+#ifdef JED_ZSTD
+  (void)format;
+  return true;
+#else
+  return format != COMPRESS_ZSTD;
+#endif
+}
+
+// The compression level can be changed with JED_COMPRESS_LEVEL
+static int compress_level(int fallback)
+{
+  const char* level = getenv("JED_COMPRESS_LEVEL");
+  return level != NULL ? atoi(level) : fallback;
+}
+
+static bool compress_read(int fd, char* data, size_t* size, size_t offset)
+{
+  while (true) {
+    const ssize_t n = pread(fd, data, COMPRESS_IN_CHUNK, (off_t)offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    *size = (size_t)n;
+    return true;
+  }
+}
+
+static bool compress_write(int fd, const char* data, size_t size)
+{
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    data += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+// Reads a file that is not compressed into out, for a copy of the text
+// that does not depend on the file staying as it is. Stops at capacity
+// should the file have grown since. The reads go through io_read() in
+// pieces that start at COMPRESS_REPORT_BYTES, so the first screen comes
+// quickly, and double up to COMPRESS_COPY_CHUNK, with progress reported
+// after each.
+static bool compress_copy(int fd, char* out, size_t capacity,
+                          Compress_Progress_Fn progress,
+                          void* progress_data, size_t* produced)
+{
+  size_t chunk = COMPRESS_REPORT_BYTES;
+  while (*produced < capacity) {
+    const size_t n =
+        capacity - *produced < chunk ? capacity - *produced : chunk;
+    size_t got = 0;
+    if (!io_read(fd, out + *produced, *produced, n, &got)) {
+      return false;
+    }
+    *produced += got;
+    if (got < n) {
+      break;
+    }
+
+    if (progress != NULL && !progress(progress_data, *produced, *produced)) {
+      errno = ECANCELED;
+      return false;
+    }
+    if (chunk < COMPRESS_COPY_CHUNK) {
+      chunk *= 2;
+    }
+  }
+  return true;
+}
+
+static bool compress_inflate_gzip(int fd, char* out, size_t capacity,
+                                  Compress_Progress_Fn progress,
+                                  void* progress_data, size_t* produced)
+{
+  z_stream z = {0};
+  // 32 lets zlib take both gzip and zlib headers
+  if (inflateInit2(&z, 15 + 32) != Z_OK) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  char* in = malloc(COMPRESS_IN_CHUNK);
+  size_t consumed = 0;
+  size_t reported = 0;
+  bool ok = true;
+  bool member_done = false;
+  size_t members = 0;
+  bool trailing = false;
+  while (ok && !trailing) {
+    size_t in_size = 0;
+    if (!compress_read(fd, in, &in_size, consumed)) {
+      ok = false;
+      break;
+    }
+    if (in_size == 0) {
+      // A file cut short in the middle of a member, unless what follows
+      // the last member is too short to tell
+      if (!member_done && (members == 0 || z.total_out > 0)) {
+        errno = EIO;
+        ok = false;
+      }
+      break;
+    }
+    z.next_in = (Bytef*)in;
+    z.avail_in = (uInt)in_size;
+
+    while (ok && !trailing && z.avail_in > 0) {
+      // Concatenated gzip files are one text, as with zcat
+      if (member_done) {
+        inflateReset(&z);
+        member_done = false;
+      }
+      size_t room = capacity - *produced;
+      if (room == 0) {
+        errno = EFBIG;
+        ok = false;
+        break;
+      }
+      if (room > UINT_MAX) {
+        room = UINT_MAX;
+      }
+      z.next_out = (Bytef*)out + *produced;
+      z.avail_out = (uInt)room;
+      const int status = inflate(&z, Z_NO_FLUSH);
+      *produced += room - z.avail_out;
+      if (status == Z_STREAM_END) {
+        member_done = true;
+        members += 1;
+      } else if (status == Z_DATA_ERROR && members > 0 && z.total_out == 0) {
+        // Whatever follows the last member is not a member, e.g. padding;
+        // gzip ignores it too
+        trailing = true;
+      } else if (status != Z_OK && status != Z_BUF_ERROR) {
+        errno = EBADMSG;
+        ok = false;
+      } else if (status == Z_BUF_ERROR && z.avail_out > 0) {
+        break;
+      }
+    }
+    consumed += in_size - z.avail_in;
+
+    if (ok && progress != NULL &&
+        *produced - reported >= COMPRESS_REPORT_BYTES) {
+      reported = *produced;
+      if (!progress(progress_data, *produced, consumed)) {
+        errno = ECANCELED;
+        ok = false;
+      }
+    }
+  }
+
+  free(in);
+  inflateEnd(&z);
+  return ok;
+}
+
+#ifdef JED_ZSTD
+static bool compress_inflate_zstd(int fd, char* out, size_t capacity,
+                                  Compress_Progress_Fn progress,
+                                  void* progress_data, size_t* produced)
+{
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  if (dctx == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  char* in = malloc(COMPRESS_IN_CHUNK);
+  size_t consumed = 0;
+  size_t reported = 0;
+  size_t last = 0;
+  bool ok = true;
+  while (ok) {
+    size_t in_size = 0;
+    if (!compress_read(fd, in, &in_size, consumed)) {
+      ok = false;
+      break;
+    }
+    if (in_size == 0) {
+      // Not at the end of a frame: the file was cut short
+      if (last != 0) {
+        errno = EIO;
+        ok = false;
+      }
+      break;
+    }
+
+    ZSTD_inBuffer input = {in, in_size, 0};
+    while (ok && input.pos < input.size) {
+      if (*produced == capacity) {
+        errno = EFBIG;
+        ok = false;
+        break;
+      }
+      ZSTD_outBuffer output = {out + *produced, capacity - *produced, 0};
+      last = ZSTD_decompressStream(dctx, &output, &input);
+      *produced += output.pos;
+      if (ZSTD_isError(last)) {
+        errno = EBADMSG;
+        ok = false;
+      }
+    }
+    consumed += input.pos;
+
+    if (ok && progress != NULL &&
+        *produced - reported >= COMPRESS_REPORT_BYTES) {
+      reported = *produced;
+      if (!progress(progress_data, *produced, consumed)) {
+        errno = ECANCELED;
+        ok = false;
+      }
+    }
+  }
+
+  free(in);
+  ZSTD_freeDCtx(dctx);
+  return ok;
+}
+#endif
+
+// Decompresses the file open as fd into out straight away, without a
+// copy in between; COMPRESS_NONE reads the file as it is. Fails with
+// EFBIG if the text does not fit in capacity bytes, and with ECANCELED if
+// progress returns false; *produced is then how much of it was done.
+// Bytes after the last gzip member are ignored, as by gzip.
+bool compress_inflate(int fd, Compress_Format format, char* out,
+                      size_t capacity, Compress_Progress_Fn progress,
+                      void* progress_data, size_t* produced)
+{
+  *produced = 0;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  bool ok = false;
+  switch (format) {
+  case COMPRESS_GZIP:
+    ok = compress_inflate_gzip(fd, out, capacity, progress, progress_data,
+                               produced);
+    break;
+  case COMPRESS_ZSTD:
+#ifdef JED_ZSTD
+    ok = compress_inflate_zstd(fd, out, capacity, progress, progress_data,
+                               produced);
+#else
+    errno = ENOTSUP;
+#endif
+    break;
+  case COMPRESS_NONE:
+    ok = compress_copy(fd, out, capacity, progress, progress_data,
+                       produced);
+    break;
+  }
+  return ok;
+}
+
+static bool compress_deflate_gzip(int fd, Pt_Iter* it,
+                                  void (*progress)(void*, size_t),
+                                  void* progress_data, size_t* written)
+{
+  z_stream z = {0};
+  // 16 asks for a gzip header instead of a zlib one
+  if (deflateInit2(&z, compress_level(COMPRESS_GZIP_LEVEL), Z_DEFLATED,
+                   15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  char* out = malloc(COMPRESS_OUT_CHUNK);
+  size_t consumed = 0;
+  size_t reported = 0;
+  bool ok = true;
+  bool more = true;
+  while (ok && more) {
+    String_View chunk = {0};
+    more = pt_iter_next(it, &chunk);
+    while (ok && chunk.count > 0) {
+      const size_t n = chunk.count < UINT_MAX ? chunk.count : UINT_MAX;
+      z.next_in = (Bytef*)chunk.data;
+      z.avail_in = (uInt)n;
+      while (ok && z.avail_in > 0) {
+        z.next_out = (Bytef*)out;
+        z.avail_out = COMPRESS_OUT_CHUNK;
+        deflate(&z, Z_NO_FLUSH);
+        const size_t size = COMPRESS_OUT_CHUNK - z.avail_out;
+        ok = compress_write(fd, out, size);
+        *written += size;
+      }
+      consumed += n;
+      sv_chop_left(&chunk, n);
+    }
+
+    if (progress != NULL && consumed - reported >= COMPRESS_REPORT_BYTES) {
+      reported = consumed;
+      progress(progress_data, consumed);
+    }
+  }
+
+  int status = Z_OK;
+  while (ok && status != Z_STREAM_END) {
+    z.next_out = (Bytef*)out;
+    z.avail_out = COMPRESS_OUT_CHUNK;
+    status = deflate(&z, Z_FINISH);
+    const size_t size = COMPRESS_OUT_CHUNK - z.avail_out;
+    ok = compress_write(fd, out, size);
+    *written += size;
+  }
+
+  free(out);
+  deflateEnd(&z);
+  return ok;
+}
+
+#ifdef JED_ZSTD
+static bool compress_deflate_zstd(int fd, Pt_Iter* it,
+                                  void (*progress)(void*, size_t),
+                                  void* progress_data, size_t* written)
+{
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  if (cctx == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                         compress_level(COMPRESS_ZSTD_LEVEL));
+
+  char* out = malloc(COMPRESS_OUT_CHUNK);
+  size_t consumed = 0;
+  size_t reported = 0;
+  bool ok = true;
+  bool more = true;
+  while (ok && more) {
+    String_View chunk = {0};
+    more = pt_iter_next(it, &chunk);
+    const ZSTD_EndDirective mode = more ? ZSTD_e_continue : ZSTD_e_end;
+    ZSTD_inBuffer input = {chunk.data, chunk.count, 0};
+    size_t left = 1;
+    while (ok && (input.pos < input.size || (!more && left != 0))) {
+      ZSTD_outBuffer output = {out, COMPRESS_OUT_CHUNK, 0};
+      left = ZSTD_compressStream2(cctx, &output, &input, mode);
+      if (ZSTD_isError(left)) {
+        errno = EIO;
+        ok = false;
+        break;
+      }
+      ok = compress_write(fd, out, output.pos);
+      *written += output.pos;
+    }
+    consumed += chunk.count;
+
+    if (progress != NULL && consumed - reported >= COMPRESS_REPORT_BYTES) {
+      reported = consumed;
+      progress(progress_data, consumed);
+    }
+  }
+
+  free(out);
+  ZSTD_freeCCtx(cctx);
+  return ok;
+}
+#endif
+
+// Writes the text of it to fd compressed, reporting progress in bytes of
+// text consumed. *written is the size of the compressed file.
+bool compress_deflate(int fd, Compress_Format format, Pt_Iter* it,
+                      void (*progress)(void* data, size_t consumed),
+                      void* progress_data, size_t* written)
+{
+  *written = 0;
+  switch (format) {
+  case COMPRESS_GZIP:
+    return compress_deflate_gzip(fd, it, progress, progress_data, written);
+  case COMPRESS_ZSTD:
+#ifdef JED_ZSTD
+    return compress_deflate_zstd(fd, it, progress, progress_data, written);
+#else
+    errno = ENOTSUP;
+    return false;
+#endif
+  case COMPRESS_NONE:
+    break;
+  }
+  errno = EINVAL;
+  return false;
+}
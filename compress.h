@@ -0,0 +1,40 @@
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+#define COMPRESS_IN_CHUNK (1024 * 1024)
+#define COMPRESS_OUT_CHUNK (1024 * 1024)
+#define COMPRESS_REPORT_BYTES (4 * 1024 * 1024)
+#define COMPRESS_COPY_CHUNK (64 * 1024 * 1024)
+
+// Deflate cannot expand data by more than this; zstd has no such bound
+#define COMPRESS_MAX_RATIO 1032
+
+typedef enum {
+  COMPRESS_NONE = 0,
+  COMPRESS_GZIP,
+  COMPRESS_ZSTD,
+} Compress_Format;
+
+// Called every COMPRESS_REPORT_BYTES or so with the bytes decompressed
+// and the compressed bytes read so far. Returning false stops.
+typedef bool (*Compress_Progress_Fn)(void* data, size_t produced,
+                                     size_t consumed);
+
+Compress_Format compress_detect(int fd);
+size_t compress_content_size(int fd, Compress_Format format);
+Compress_Format compress_format_of_path(const char* path);
+const char* compress_format_name(Compress_Format format);
+bool compress_supported(Compress_Format format);
+
+bool compress_inflate(int fd, Compress_Format format, char* out,
+                      size_t capacity, Compress_Progress_Fn progress,
+                      void* progress_data, size_t* produced);
+bool compress_deflate(int fd, Compress_Format format, Pt_Iter* it,
+                      void (*progress)(void* data, size_t consumed),
+                      void* progress_data, size_t* written);
+
+#endif  // COMPRESS_H_
@@ -1,206 +1,1402 @@
+// F_SETLEASE and mremap()
+#define _GNU_SOURCE
 #include "./editor.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #define SV_IMPLEMENTATION
 #include "./sv.h"
+#include "./io.h"
 
-#define LINE_INIT_CAPACITY 1024
-#define EDITOR_INIT_CAPACITY 128
+#define EDITOR_READ_CHUNK_SIZE (640 * 1024)
+#define EDITOR_CURSORS_INIT_CAPACITY 16
+// Each cursor edits the text by a record of its own in the undo log and
+// an op of its own in the journal, so their number is bounded
+#define EDITOR_MAX_CURSORS 4096
+#define EDITOR_MIN_RESERVE (1024 * 1024)
+#define EDITOR_MAX_RESERVE ((size_t)1 << 44)
 
-static void editor_create_first_new_line(Editor* editor);
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
 
-static void line_grow(Line* line, size_t n)
+size_t editor_rows(const Editor* editor)
 {
-  size_t new_capacity = line->capacity;
+  return pt_rows(&editor->pt);
+}
 
-  assert(new_capacity >= line->size);
-  while (new_capacity - line->size < n) {
-    if (new_capacity == 0) {
-      new_capacity = LINE_INIT_CAPACITY;
-    } else {
-      new_capacity *= 2;
-    }
+size_t editor_line_start(const Editor* editor, size_t row)
+{
+  return pt_line_start(&editor->pt, row);
+}
+
+size_t editor_line_size(const Editor* editor, size_t row)
+{
+  return pt_line_size(&editor->pt, row);
+}
+
+// Iterates bytes [first_col, last_col) of row, clamped to the line and
+// without its '\n'. Only touches the part of a long line that is asked
+// for.
+Pt_Iter editor_line_iter(const Editor* editor, size_t row, size_t first_col,
+                         size_t last_col)
+{
+  const size_t start = editor_line_start(editor, row);
+  const size_t size = editor_line_size(editor, row);
+  if (last_col > size) {
+    last_col = size;
+  }
+  if (first_col > last_col) {
+    first_col = last_col;
+  }
+  return pt_iter(&editor->pt, start + first_col, start + last_col);
+}
+
+// Clamps the cursor to the text and returns its offset in the table
+static size_t editor_cursor_offset(Editor* editor)
+{
+  const size_t rows = editor_rows(editor);
+  if (editor->cursor_row >= rows) {
+    editor->cursor_row = rows - 1;
+  }
+
+  const size_t line_size = editor_line_size(editor, editor->cursor_row);
+  if (editor->cursor_col > line_size) {
+    editor->cursor_col = line_size;
+  }
+
+  return editor_line_start(editor, editor->cursor_row) + editor->cursor_col;
+}
+
+// Offset of the given position, clamped to the text
+static size_t editor_offset_of(const Editor* editor, size_t row, size_t col)
+{
+  const size_t rows = editor_rows(editor);
+  if (row >= rows) {
+    row = rows - 1;
+  }
+
+  const size_t line_size = editor_line_size(editor, row);
+  if (col > line_size) {
+    col = line_size;
+  }
+
+  return editor_line_start(editor, row) + col;
+}
+
+static void editor_move_cursor_to(Editor* editor, size_t offset)
+{
+  editor->cursor_row = pt_row_of(&editor->pt, offset);
+  editor->cursor_col = offset - editor_line_start(editor, editor->cursor_row);
+}
+
+// Replaces count bytes at offset with the text of piece. Every change of
+// the text goes through here so it ends up in the undo log and the
+// journal.
+static void editor_splice_piece(Editor* editor, size_t offset, size_t count,
+                                Piece inserted)
+{
+  Undo_Record record = {
+      .offset = offset,
+      .removed_size = count,
+      .inserted_size = inserted.size,
+      .inserted_count = inserted.size > 0 ? 1 : 0,
+      .cursor = editor_cursor_offset(editor),
+  };
+  const Piece* removed = undo_collect(&editor->undo, &editor->pt, offset,
+                                      count, &record.removed_count);
+
+  pt_delete(&editor->pt, offset, count);
+  pt_insert_piece(&editor->pt, offset, inserted);
+
+  undo_push(&editor->undo, &record, removed, &inserted);
+  journal_splice(&editor->journal, &editor->pt, offset, count, &inserted,
+                 record.inserted_count);
+}
+
+static void editor_splice(Editor* editor, size_t offset, size_t count,
+                          const char* text, size_t text_size)
+{
+  const Piece inserted = text_size > 0
+                             ? pt_append_add(&editor->pt, text, text_size)
+                             : (Piece){0};
+  editor_splice_piece(editor, offset, count, inserted);
+}
+
+void editor_start_selection(Editor* editor)
+{
+  if (!editor->selection) {
+    editor_cursor_offset(editor);
+    editor->selection = true;
+    editor->anchor_row = editor->cursor_row;
+    editor->anchor_col = editor->cursor_col;
+  }
+}
+
+void editor_clear_selection(Editor* editor)
+{
+  editor->selection = false;
+}
+
+// Stores the offsets of the selected text in begin and end. Returns
+// false if nothing is selected.
+bool editor_selection(const Editor* editor, size_t* begin, size_t* end)
+{
+  if (!editor->selection) {
+    return false;
   }
 
-  if (new_capacity != line->capacity) {
-    line->chars = realloc(line->chars, new_capacity);
-    line->capacity = new_capacity;
+  const size_t anchor =
+      editor_offset_of(editor, editor->anchor_row, editor->anchor_col);
+  const size_t cursor =
+      editor_offset_of(editor, editor->cursor_row, editor->cursor_col);
+  *begin = anchor < cursor ? anchor : cursor;
+  *end = anchor < cursor ? cursor : anchor;
+  return *begin < *end;
+}
+
+// Offset that offset moves to when [begin, end) is replaced with size
+// bytes
+static size_t editor_shift(size_t offset, size_t begin, size_t end,
+                           size_t size)
+{
+  if (offset <= begin) {
+    return offset;
   }
+  if (offset < end) {
+    return begin + size;
+  }
+  return offset - (end - begin) + size;
 }
 
-void line_append_text(Line* line, const char* text, size_t text_size)
+// Replaces [begin, end) with text as one undo step and puts the cursor
+// after it. The range is cut out of the tree and the text goes in as a
+// single piece, so the cost depends on the number of pieces the range
+// covers, not on how many characters or lines it spans.
+void editor_replace_range(Editor* editor, size_t begin, size_t end,
+                          const char* text, size_t text_size)
 {
-  size_t col = line->size;
-  line_insert_text_before(line, text, text_size, &col);
+  if (end > editor->pt.size) {
+    end = editor->pt.size;
+  }
+  if (begin > end) {
+    begin = end;
+  }
+
+  undo_begin_group(&editor->undo);
+  editor_splice(editor, begin, end - begin, text, text_size);
+  undo_end_group(&editor->undo);
+
+  // Extra cursors keep pointing at the same text, those inside the range
+  // end up after the new text
+  for (size_t i = 0; i < editor->cursors_size; ++i) {
+    Editor_Cursor* cursor = &editor->cursors[i];
+    cursor->offset = editor_shift(cursor->offset, begin, end, text_size);
+    cursor->anchor = editor_shift(cursor->anchor, begin, end, text_size);
+  }
+
+  editor->selection = false;
+  editor_move_cursor_to(editor, begin + text_size);
+}
+
+void editor_delete_range(Editor* editor, size_t begin, size_t end)
+{
+  editor_replace_range(editor, begin, end, NULL, 0);
 }
 
-void line_insert_text_before(Line* line, const char* text, size_t text_size,
-                             size_t* col)
+// Returns a NUL-terminated copy of [begin, end) that the caller frees
+char* editor_copy_range(const Editor* editor, size_t begin, size_t end)
 {
-  if (*col > line->size) {
-    *col = line->size;
+  Pt_Iter it = pt_iter(&editor->pt, begin, end);
+  char* text = malloc(it.remaining + 1);
+  size_t size = 0;
+  String_View chunk = {0};
+  while (pt_iter_next(&it, &chunk)) {
+    memcpy(text + size, chunk.data, chunk.count);
+    size += chunk.count;
   }
+  text[size] = '\0';
+  return text;
+}
 
-  line_grow(line, text_size);
+// Returns false if there are EDITOR_MAX_CURSORS cursors already
+bool editor_add_cursor(Editor* editor, size_t offset, size_t anchor)
+{
+  if (editor->cursors_size >= EDITOR_MAX_CURSORS) {
+    return false;
+  }
+  if (editor->cursors_size >= editor->cursors_capacity) {
+    editor->cursors_capacity = editor->cursors_capacity == 0
+                                   ? EDITOR_CURSORS_INIT_CAPACITY
+                                   : editor->cursors_capacity * 2;
+    editor->cursors =
+        realloc(editor->cursors,
+                editor->cursors_capacity * sizeof(editor->cursors[0]));
+  }
+  editor->cursors[editor->cursors_size++] = (Editor_Cursor){
+      .offset = offset,
+      .anchor = anchor,
+  };
+  return true;
+}
+
+// Leaves an extra cursor, with the selection if any, where the main one
+// is, e.g. before the main one is moved somewhere else
+void editor_duplicate_cursor(Editor* editor)
+{
+  const size_t offset = editor_cursor_offset(editor);
+  const size_t anchor =
+      editor->selection
+          ? editor_offset_of(editor, editor->anchor_row, editor->anchor_col)
+          : offset;
+  editor_add_cursor(editor, offset, anchor);
+  editor->selection = false;
+}
 
-  memmove(line->chars + *col + text_size, line->chars + *col,
-          line->size - *col);
-  memcpy(line->chars + *col, text, text_size);
-  line->size += text_size;
-  *col += text_size;
+void editor_clear_cursors(Editor* editor)
+{
+  editor->cursors_size = 0;
 }
 
-void line_backspace(Line* line, size_t* col)
+// Whether pattern occurs at offset, possibly across several pieces
+static bool editor_matches_at(const Editor* editor, size_t offset,
+                              const char* pattern, size_t pattern_size)
 {
-  if (*col > line->size) {
-    *col = line->size;
+  Pt_Iter it = pt_iter(&editor->pt, offset, offset + pattern_size);
+  if (it.remaining < pattern_size) {
+    return false;
   }
 
-  if (*col > 0 && line->size > 0) {
-    memmove(line->chars + *col - 1, line->chars + *col, line->size - *col);
-    line->size -= 1;
-    *col -= 1;
+  String_View chunk = {0};
+  while (pt_iter_next(&it, &chunk)) {
+    if (memcmp(chunk.data, pattern, chunk.count) != 0) {
+      return false;
+    }
+    pattern += chunk.count;
   }
+  return true;
 }
 
-void line_delete(Line* line, size_t* col)
+// Puts an extra cursor on every other occurrence of the selected text,
+// up to EDITOR_MAX_CURSORS, each one selecting its occurrence, so that
+// typing replaces all of them at once. Returns the number of cursors
+// added.
+size_t editor_select_occurrences(Editor* editor)
 {
-  if (*col > line->size) {
-    *col = line->size;
+  size_t begin = 0;
+  size_t end = 0;
+  if (!editor_selection(editor, &begin, &end)) {
+    return 0;
   }
 
-  if (*col < line->size && line->size > 0) {
-    memmove(line->chars + *col, line->chars + *col + 1, line->size - *col);
-    line->size -= 1;
+  char* pattern = editor_copy_range(editor, begin, end);
+  const size_t pattern_size = end - begin;
+  const size_t before = editor->cursors_size;
+
+  // Candidates come from memchr() on the first byte within each chunk,
+  // only the few that run past the end of a chunk need the slow check
+  Pt_Iter it = pt_iter(&editor->pt, 0, editor->pt.size);
+  String_View chunk = {0};
+  size_t chunk_offset = 0;
+  size_t next = 0;
+  bool room = true;
+  while (room && pt_iter_next(&it, &chunk)) {
+    size_t i = next > chunk_offset ? next - chunk_offset : 0;
+    while (room && i < chunk.count) {
+      const char* hit = memchr(chunk.data + i, pattern[0], chunk.count - i);
+      if (hit == NULL) {
+        break;
+      }
+      i = (size_t)(hit - chunk.data);
+
+      const size_t offset = chunk_offset + i;
+      const bool match =
+          i + pattern_size <= chunk.count
+              ? memcmp(hit, pattern, pattern_size) == 0
+              : editor_matches_at(editor, offset, pattern, pattern_size);
+      if (match) {
+        if (offset != begin) {
+          room = editor_add_cursor(editor, offset + pattern_size, offset);
+        }
+        i += pattern_size;
+        next = offset + pattern_size;
+      } else {
+        i += 1;
+      }
+    }
+    chunk_offset += chunk.count;
   }
+
+  free(pattern);
+  return editor->cursors_size - before;
 }
 
-static void editor_grow(Editor* editor, size_t n)
+typedef enum {
+  EDITOR_EDIT_INSERT,
+  EDITOR_EDIT_NEW_LINE,
+  EDITOR_EDIT_BACKSPACE,
+  EDITOR_EDIT_DELETE,
+} Editor_Edit_Kind;
+
+// Range an edit replaces for one cursor. Index 0 is the main cursor,
+// index i + 1 is editor->cursors[i].
+typedef struct {
+  size_t begin;
+  size_t end;
+  size_t cursor;
+  size_t index;
+} Editor_Edit;
+
+static int editor_edit_compare(const void* a, const void* b)
 {
-  size_t new_capacity = editor->capacity;
+  const Editor_Edit* x = a;
+  const Editor_Edit* y = b;
+  if (x->begin != y->begin) {
+    return x->begin < y->begin ? -1 : 1;
+  }
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static Editor_Edit editor_edit_at(const Editor* editor,
+                                  Editor_Edit_Kind kind, size_t offset,
+                                  size_t anchor, size_t index)
+{
+  Editor_Edit edit = {
+      .begin = anchor < offset ? anchor : offset,
+      .end = anchor < offset ? offset : anchor,
+      .cursor = offset,
+      .index = index,
+  };
+  if (edit.begin < edit.end) {
+    return edit;
+  }
 
-  assert(new_capacity >= editor->size);
-  while (new_capacity - editor->size < n) {
-    if (new_capacity == 0) {
-      new_capacity = EDITOR_INIT_CAPACITY;
+  // Same rules as for the single cursor: backspace and delete stay
+  // within the line, new lines go after the end of the line
+  const char* c = NULL;
+  switch (kind) {
+  case EDITOR_EDIT_INSERT:
+    break;
+  case EDITOR_EDIT_NEW_LINE: {
+    const size_t row = pt_row_of(&editor->pt, offset);
+    edit.begin = editor_line_start(editor, row) + editor_line_size(editor, row);
+    edit.end = edit.begin;
+  } break;
+  case EDITOR_EDIT_BACKSPACE:
+    c = offset > 0 ? pt_char_at(&editor->pt, offset - 1) : NULL;
+    if (c != NULL && *c != '\n') {
+      edit.begin = offset - 1;
+    }
+    break;
+  case EDITOR_EDIT_DELETE:
+    c = pt_char_at(&editor->pt, offset);
+    if (c != NULL && *c != '\n') {
+      edit.end = offset + 1;
+    }
+    break;
+  }
+  return edit;
+}
+
+// Stores the ranges an edit replaces at every cursor in edits, sorted,
+// and returns how many there are. Ranges that overlap an earlier one or
+// start at the same place are dropped along with their cursor. The
+// caller frees edits.
+static size_t editor_edits(Editor* editor, Editor_Edit_Kind kind,
+                           Editor_Edit** result)
+{
+  const size_t count = editor->cursors_size + 1;
+  Editor_Edit* edits = malloc(count * sizeof(edits[0]));
+
+  size_t main_anchor = editor_cursor_offset(editor);
+  const size_t main_offset = main_anchor;
+  if (editor->selection) {
+    main_anchor =
+        editor_offset_of(editor, editor->anchor_row, editor->anchor_col);
+  }
+  edits[0] = editor_edit_at(editor, kind, main_offset, main_anchor, 0);
+  for (size_t i = 0; i < editor->cursors_size; ++i) {
+    const Editor_Cursor* cursor = &editor->cursors[i];
+    edits[i + 1] = editor_edit_at(editor, kind, cursor->offset,
+                                  cursor->anchor, i + 1);
+  }
+  qsort(edits, count, sizeof(edits[0]), editor_edit_compare);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (kept > 0 && (edits[i].begin < edits[kept - 1].end ||
+                     edits[i].begin == edits[kept - 1].begin)) {
+      if (edits[i].index != 0) {
+        continue;
+      }
+      edits[i] = edits[kept - 1];
+      edits[i].index = 0;
+      kept -= 1;
+    }
+    edits[kept++] = edits[i];
+  }
+
+  *result = edits;
+  return kept;
+}
+
+// Applies one edit at every cursor as a single undo step. The edits are
+// applied from the bottom of the text up, so none of them shifts the
+// ones still to be done, and the text goes into the add buffer once and
+// is shared by the pieces of all the insertions. Every cursor still
+// adds an undo record and a journal op, hence EDITOR_MAX_CURSORS.
+static void editor_edit_cursors(Editor* editor, Editor_Edit_Kind kind,
+                                const char* text, size_t text_size)
+{
+  Editor_Edit* edits = NULL;
+  const size_t kept = editor_edits(editor, kind, &edits);
+
+  const Piece inserted = text_size > 0
+                             ? pt_append_add(&editor->pt, text, text_size)
+                             : (Piece){0};
+  undo_begin_group(&editor->undo);
+  for (size_t i = kept; i-- > 0;) {
+    const Editor_Edit* edit = &edits[i];
+    if (edit->begin < edit->end || inserted.size > 0) {
+      editor_splice_piece(editor, edit->begin, edit->end - edit->begin,
+                          inserted);
+    }
+  }
+  undo_end_group(&editor->undo);
+
+  // Every cursor lands after its edit, moved by the edits above it
+  size_t shift = 0;
+  editor->cursors_size = 0;
+  editor->selection = false;
+  for (size_t i = 0; i < kept; ++i) {
+    const Editor_Edit* edit = &edits[i];
+    const bool applied = edit->begin < edit->end || inserted.size > 0;
+    const size_t cursor =
+        applied ? edit->begin + shift + inserted.size : edit->cursor + shift;
+    if (applied) {
+      shift = shift + inserted.size - (edit->end - edit->begin);
+    }
+
+    if (edit->index == 0) {
+      editor_move_cursor_to(editor, cursor);
     } else {
-      new_capacity *= 2;
+      editor_add_cursor(editor, cursor, cursor);
+    }
+  }
+
+  free(edits);
+}
+
+// Returns the selected text of every cursor in text order, one selection
+// per line and NUL-terminated, for the caller to free. Returns NULL if
+// nothing is selected.
+char* editor_copy_selections(Editor* editor)
+{
+  Editor_Edit* edits = NULL;
+  const size_t count = editor_edits(editor, EDITOR_EDIT_INSERT, &edits);
+
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (edits[i].begin < edits[i].end) {
+      size += edits[i].end - edits[i].begin + 1;
     }
   }
+  if (size == 0) {
+    free(edits);
+    return NULL;
+  }
 
-  if (new_capacity != editor->capacity) {
-    editor->lines =
-        realloc(editor->lines, new_capacity * sizeof(editor->lines[0]));
-    editor->capacity = new_capacity;
+  char* text = malloc(size);
+  size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (edits[i].begin == edits[i].end) {
+      continue;
+    }
+    if (size > 0) {
+      text[size++] = '\n';
+    }
+    Pt_Iter it = pt_iter(&editor->pt, edits[i].begin, edits[i].end);
+    String_View chunk = {0};
+    while (pt_iter_next(&it, &chunk)) {
+      memcpy(text + size, chunk.data, chunk.count);
+      size += chunk.count;
+    }
   }
+  text[size] = '\0';
+
+  free(edits);
+  return text;
 }
 
+// Deletes the selected text of every cursor as one undo step
+void editor_cut_selections(Editor* editor)
+{
+  editor_edit_cursors(editor, EDITOR_EDIT_INSERT, NULL, 0);
+}
+
+// Deletes the selection, if any. Returns true if there was one.
+static bool editor_delete_selection(Editor* editor)
+{
+  size_t begin = 0;
+  size_t end = 0;
+  const bool selected = editor_selection(editor, &begin, &end);
+  editor->selection = false;
+  if (selected) {
+    editor_delete_range(editor, begin, end);
+  }
+  return selected;
+}
+
+// Deletes the selections, then breaks the line after each cursor
 void editor_insert_new_line(Editor* editor)
 {
-  if (editor->cursor_row > editor->size) {
-    editor->cursor_row = editor->size;
+  if (editor->cursors_size > 0) {
+    undo_begin_group(&editor->undo);
+    editor_cut_selections(editor);
+    editor_edit_cursors(editor, EDITOR_EDIT_NEW_LINE, "\n", 1);
+    undo_end_group(&editor->undo);
+    return;
   }
 
-  editor_grow(editor, 1);
+  undo_begin_group(&editor->undo);
+  editor_delete_selection(editor);
+  editor_cursor_offset(editor);
 
-  const size_t line_size = sizeof(editor->lines[0]);
-  memmove(editor->lines + editor->cursor_row + 1,
-          editor->lines + editor->cursor_row,
-          (editor->size - editor->cursor_row) * line_size);
-  memset(&editor->lines[editor->cursor_row + 1], 0, line_size);
+  const size_t end = editor_line_start(editor, editor->cursor_row) +
+                     editor_line_size(editor, editor->cursor_row);
+  editor_splice(editor, end, 0, "\n", 1);
   editor->cursor_row += 1;
   editor->cursor_col = 0;
-  editor->size += 1;
+  undo_end_group(&editor->undo);
 }
 
-static void editor_create_first_new_line(Editor* editor)
+void editor_insert_text_before_cursor(Editor* editor, const char* text)
 {
-  if (editor->cursor_row >= editor->size) {
-    if (editor->size > 0) {
-      editor->cursor_row = editor->size - 1;
-    } else {
-      editor_grow(editor, 1);
-      memset(&editor->lines[editor->size], 0, sizeof(editor->lines[0]));
-      editor->size += 1;
-    }
+  const size_t text_size = strlen(text);
+  if (editor->selection || editor->cursors_size > 0) {
+    editor_insert_text(editor, text, text_size);
+    return;
   }
+
+  editor_splice(editor, editor_cursor_offset(editor), 0, text, text_size);
+  editor->cursor_col += text_size;
 }
 
-void editor_insert_text_before_cursor(Editor* editor, const char* text)
+// Inserts text of any size, newlines included, in place of the selection
+// or before the cursor and moves the cursor past it. The text is copied
+// into an add buffer and indexed in one go and lands in the tree as a
+// single piece, so pasting megabytes costs about as much as the memcpy.
+// It is undone as a whole and never merged with the typing around it.
+void editor_insert_text(Editor* editor, const char* text, size_t text_size)
 {
-  editor_create_first_new_line(editor);
-  line_insert_text_before(&editor->lines[editor->cursor_row], text,
-                          strlen(text), &editor->cursor_col);
+  if (editor->cursors_size > 0) {
+    editor_edit_cursors(editor, EDITOR_EDIT_INSERT, text, text_size);
+    return;
+  }
+
+  size_t begin = editor_cursor_offset(editor);
+  size_t end = begin;
+  // Nothing to do, and an empty undo step would throw away the redo
+  // history
+  if (!editor_selection(editor, &begin, &end) && text_size == 0) {
+    return;
+  }
+  editor_replace_range(editor, begin, end, text, text_size);
 }
 
 void editor_backspace(Editor* editor)
 {
-  editor_create_first_new_line(editor);
-  line_backspace(&editor->lines[editor->cursor_row], &editor->cursor_col);
+  if (editor->cursors_size > 0) {
+    editor_edit_cursors(editor, EDITOR_EDIT_BACKSPACE, NULL, 0);
+    return;
+  }
+  if (editor_delete_selection(editor)) {
+    return;
+  }
+
+  const size_t offset = editor_cursor_offset(editor);
+  if (editor->cursor_col > 0) {
+    editor_splice(editor, offset - 1, 1, NULL, 0);
+    editor->cursor_col -= 1;
+  }
 }
 
 void editor_delete(Editor* editor)
 {
-  editor_create_first_new_line(editor);
-  line_delete(&editor->lines[editor->cursor_row], &editor->cursor_col);
+  if (editor->cursors_size > 0) {
+    editor_edit_cursors(editor, EDITOR_EDIT_DELETE, NULL, 0);
+    return;
+  }
+  if (editor_delete_selection(editor)) {
+    return;
+  }
+
+  const size_t offset = editor_cursor_offset(editor);
+  if (editor->cursor_col < editor_line_size(editor, editor->cursor_row)) {
+    editor_splice(editor, offset, 1, NULL, 0);
+  }
+}
+
+// Background jobs such as saving read the text through a snapshot, which
+// stays unchanged while the editor keeps going
+Pt_Snapshot editor_snapshot(Editor* editor)
+{
+  return pt_snapshot(&editor->pt);
+}
+
+void editor_release_snapshot(Editor* editor, Pt_Snapshot* snapshot)
+{
+  pt_snapshot_release(&editor->pt, snapshot);
+}
+
+// Puts pieces back at offset in place of the count bytes there
+static void editor_restore(Editor* editor, size_t offset, size_t count,
+                           const Piece* pieces, size_t pieces_count)
+{
+  journal_splice(&editor->journal, &editor->pt, offset, count, pieces,
+                 pieces_count);
+  pt_delete(&editor->pt, offset, count);
+  for (size_t i = 0; i < pieces_count; ++i) {
+    pt_insert_piece(&editor->pt, offset, pieces[i]);
+    offset += pieces[i].size;
+  }
+}
+
+// Reverts the newest group of edits. Returns false if there was nothing
+// to undo.
+bool editor_undo(Editor* editor)
+{
+  Undo_Record record;
+  const Piece* pieces = NULL;
+  size_t group = 0;
+  editor->cursors_size = 0;
+  editor->selection = false;
+  while (undo_step_back(&editor->undo, group, &record, &pieces)) {
+    editor_restore(editor, record.offset, record.inserted_size, pieces,
+                   record.removed_count);
+    editor_move_cursor_to(editor, record.cursor);
+    group = record.group;
+  }
+  return group != 0;
+}
+
+bool editor_redo(Editor* editor)
+{
+  Undo_Record record;
+  const Piece* pieces = NULL;
+  size_t group = 0;
+  editor->cursors_size = 0;
+  editor->selection = false;
+  while (undo_step_forward(&editor->undo, group, &record, &pieces)) {
+    editor_restore(editor, record.offset, record.removed_size,
+                   pieces + record.removed_count, record.inserted_count);
+    editor_move_cursor_to(editor, record.offset + record.inserted_size);
+    group = record.group;
+  }
+  return group != 0;
 }
 
 const char* editor_char_under_cursor(const Editor* editor)
 {
-  if (editor->cursor_row < editor->size) {
-    if (editor->cursor_col < editor->lines[editor->cursor_row].size) {
-      return &editor->lines[editor->cursor_row].chars[editor->cursor_col];
+  if (editor->cursor_row < editor_rows(editor)) {
+    if (editor->cursor_col < editor_line_size(editor, editor->cursor_row)) {
+      return pt_char_at(&editor->pt,
+                        editor_line_start(editor, editor->cursor_row) +
+                            editor->cursor_col);
     }
   }
   return NULL;
 }
 
-void editor_save_to_file(const Editor* editor, const char* file_path)
+// Replaces the file atomically, see save_atomic(). Failures are
+// reported in result instead of ending the program.
+bool editor_save_to_file(const Editor* editor, const char* file_path,
+                         Save_Result* result)
+{
+  return save_atomic(file_path, pt_iter(&editor->pt, 0, editor->pt.size),
+                     editor->compressed, NULL, NULL, result);
+}
+
+// Like editor_save_to_file() but writes a snapshot of the text on a
+// background thread and returns right away; editing can go on while the
+// file is written. Returns false if a save is already running or the
+// file is still being loaded.
+bool editor_start_saving(Editor* editor, const char* file_path)
+{
+  if (editor->loader.running || editor->saver.running) {
+    return false;
+  }
+
+  journal_begin_save(&editor->journal);
+  watcher_begin_save(&editor->watcher, &editor->pt);
+  if (!saver_start(&editor->saver, &editor->pt, file_path,
+                   editor->compressed)) {
+    journal_end_save(&editor->journal, false);
+    watcher_end_save(&editor->watcher, &editor->pt, false);
+    return false;
+  }
+  return true;
+}
+
+// Returns true once, when the save started by editor_start_saving() has
+// finished, with its outcome in result
+bool editor_poll_saving(Editor* editor, Save_Result* result)
+{
+  if (!saver_poll(&editor->saver, &editor->pt, result)) {
+    return false;
+  }
+  journal_end_save(&editor->journal, result->failed == NULL);
+  watcher_end_save(&editor->watcher, &editor->pt, result->failed == NULL);
+  return true;
+}
+
+// Waits for a running save, e.g. before quitting. Returns false if there
+// was none.
+bool editor_finish_saving(Editor* editor, Save_Result* result)
 {
-  FILE* f = fopen(file_path, "w");
-  if (f == NULL) {
-    fprintf(stdout, "ERROR: could not open file `%s`: %s\n", file_path,
+  if (!saver_wait(&editor->saver, &editor->pt, result)) {
+    return false;
+  }
+  journal_end_save(&editor->journal, result->failed == NULL);
+  watcher_end_save(&editor->watcher, &editor->pt, result->failed == NULL);
+  return true;
+}
+
+bool editor_saving(const Editor* editor)
+{
+  return editor->saver.running;
+}
+
+float editor_save_progress(Editor* editor)
+{
+  return saver_progress(&editor->saver);
+}
+
+// Replays the journal a crashed session left behind for file_path, then
+// journals the edits of this one. Returns the number of edits recovered.
+size_t editor_open_journal(Editor* editor, const char* file_path)
+{
+  size_t recovered = 0;
+  if (journal_exists(file_path)) {
+    // The journal refers to the whole file
+    const struct timespec pause = {.tv_nsec = 1000 * 1000};
+    while (editor_poll_loading(editor)) {
+      editor_poll_mapping(editor);
+      nanosleep(&pause, NULL);
+    }
+    recovered = journal_replay(file_path, &editor->pt);
+  }
+
+  if (!journal_start(&editor->journal, file_path, &editor->pt,
+                     recovered > 0)) {
+    fprintf(stderr, "WARNING: could not start the journal of `%s`\n",
+            file_path);
+  }
+  return recovered;
+}
+
+// Compacts the journal once in a while; it needs the whole file
+void editor_poll_journal(Editor* editor)
+{
+  journal_poll(&editor->journal, &editor->pt, !editor->loader.running);
+}
+
+void editor_close_journal(Editor* editor)
+{
+  journal_stop(&editor->journal, &editor->pt);
+}
+
+// Watches file_path for writes by other programs, see watcher_poll()
+void editor_start_watching(Editor* editor, const char* file_path)
+{
+  // The file on disk is not the text, so there is nothing to compare
+  if (editor->compressed != COMPRESS_NONE) {
+    return;
+  }
+  if (!watcher_start(&editor->watcher, file_path)) {
+    fprintf(stderr, "WARNING: could not watch `%s` for changes: %s\n",
+            file_path, strerror(errno));
+    return;
+  }
+  if (!editor->loader.running) {
+    watcher_set_disk(&editor->watcher, &editor->pt);
+  }
+}
+
+// Takes in what another program changed in the file, unless the text has
+// edits of its own. Only the changed region is replaced; the rest of the
+// text and its line index stay as they are. The undo log is dropped since
+// it may refer to the old file.
+Watch_Event editor_poll_watching(Editor* editor)
+{
+  // The text has to be a copy by the time a change is taken in
+  editor_poll_mapping(editor);
+
+  Watch_Change change = {0};
+  const Watch_Event event =
+      watcher_poll(&editor->watcher, &editor->pt,
+                   editor->loader.running || editor->saver.running, &change);
+  if (event != WATCH_RELOAD) {
+    return event;
+  }
+
+  const size_t cursor = editor_cursor_offset(editor);
+  pt_delete(&editor->pt, change.begin, change.end - change.begin);
+  if (change.size > 0) {
+    pt_insert(&editor->pt, change.begin, change.data, change.size);
+  }
+  free(change.data);
+
+  undo_clear(&editor->undo);
+  editor->cursors_size = 0;
+  editor->selection = false;
+  editor_move_cursor_to(editor, cursor < editor->pt.size ? cursor
+                                                         : editor->pt.size);
+
+  // The journal starts over from the file as it is now
+  journal_begin_save(&editor->journal);
+  journal_end_save(&editor->journal, true);
+  watcher_set_disk(&editor->watcher, &editor->pt);
+  return event;
+}
+
+void editor_stop_watching(Editor* editor)
+{
+  watcher_stop(&editor->watcher, &editor->pt);
+}
+
+// Appends whatever gets written to the file after the part that was
+// loaded from it, see follower_poll(). Call right after loading, with
+// the file still open.
+void editor_start_following(Editor* editor, const char* file_path,
+                            FILE* file)
+{
+  if (editor->compressed != COMPRESS_NONE) {
+    fprintf(stderr, "WARNING: cannot follow compressed file `%s`\n",
+            file_path);
+    return;
+  }
+
+  size_t loaded = 0;
+  if (editor->pt.mapping != NULL) {
+    loaded = editor->pt.mapping_size;
+  } else if (editor->pt.buffers_size > 0) {
+    loaded = editor->pt.buffers[0].size;
+  }
+
+  const int fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, 0);
+  if (fd < 0 ||
+      !follower_start(&editor->follower, file_path, fd, loaded)) {
+    fprintf(stderr, "WARNING: could not follow `%s`: %s\n", file_path,
             strerror(errno));
+  }
+}
+
+// The cursor sticks to the end of the text while it is there, so the
+// view keeps up with the new lines
+Follow_Event editor_poll_following(Editor* editor)
+{
+  if (editor->loader.running) {
+    return FOLLOW_NONE;
+  }
+
+  const bool at_end = editor->cursors_size == 0 && !editor->selection &&
+                      editor_cursor_offset(editor) == editor->pt.size;
+  size_t appended = 0;
+  const Follow_Event event =
+      follower_poll(&editor->follower, &editor->pt, &appended);
+  if (at_end && appended > 0) {
+    editor_move_cursor_to(editor, editor->pt.size);
+  }
+  return event;
+}
+
+void editor_stop_following(Editor* editor)
+{
+  follower_stop(&editor->follower);
+}
+
+// Fills the editor from a pipe as the data comes in, see streamer_poll()
+bool editor_start_streaming(Editor* editor, int fd)
+{
+  assert(editor->pt.buffers_size == 0 &&
+         "You can only stream into an empty editor");
+  return streamer_start(&editor->streamer, fd);
+}
+
+// Returns true while more input may come. Like a followed file, the
+// cursor sticks to the end while it is there.
+bool editor_poll_streaming(Editor* editor)
+{
+  const bool at_end = editor->cursors_size == 0 && !editor->selection &&
+                      editor_cursor_offset(editor) == editor->pt.size;
+  size_t appended = 0;
+  const bool streaming =
+      streamer_poll(&editor->streamer, &editor->pt, &appended);
+  if (at_end && appended > 0) {
+    editor_move_cursor_to(editor, editor->pt.size);
+  }
+  return streaming;
+}
+
+bool editor_streaming(const Editor* editor)
+{
+  return editor->streamer.running;
+}
+
+void editor_stop_streaming(Editor* editor)
+{
+  streamer_stop(&editor->streamer);
+}
+
+// Reads the whole file with large reads in flight at once, see
+// io_read(), when its size is known up front; falls back to chunked
+// reads for pipes and other streams.
+static char* read_entire_file(FILE* file, size_t* size)
+{
+  char* data = NULL;
+  size_t capacity = 0;
+  *size = 0;
+
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long n = ftell(file);
+    if (n >= 0) {
+      capacity = (size_t)n;
+      data = malloc(capacity > 0 ? capacity : 1);
+      if (!io_read(fileno(file), data, 0, capacity, size)) {
+        fprintf(stderr, "ERROR: could not read file: %s\n",
+                strerror(errno));
+        exit(1);
+      }
+      fseek(file, (long)*size, SEEK_SET);
+
+      // The file may still grow behind our back
+      int c = fgetc(file);
+      if (c != EOF) {
+        ungetc(c, file);
+      }
+    }
+  }
+
+  while (!feof(file) && !ferror(file)) {
+    if (capacity - *size < EDITOR_READ_CHUNK_SIZE) {
+      capacity = capacity == 0 ? EDITOR_READ_CHUNK_SIZE : capacity * 2;
+      data = realloc(data, capacity);
+    }
+    *size += fread(data + *size, 1, capacity - *size, file);
+  }
+
+  if (ferror(file)) {
+    fprintf(stderr, "ERROR: could not read file: %s\n", strerror(errno));
     exit(1);
   }
 
-  for (size_t row = 0; row < editor->size; ++row) {
-    fwrite(editor->lines[row].chars, 1, editor->lines[row].size, f);
-    fputc('\n', f);
+  return data;
+}
+
+// Set by SIGIO once another process opens the mapped file for writing
+// or truncates it
+static volatile sig_atomic_t lease_broken = 0;
+
+static void on_lease_break(int signal)
+{
+  (void)signal;
+  lease_broken = 1;
+}
+
+// Asks the kernel to hold back any process that wants to change the file
+// open as fd until the lease is released
+static bool take_lease(int fd)
+{
+  struct sigaction sa = {0};
+  sa.sa_handler = on_lease_break;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  return sigaction(SIGIO, &sa, NULL) == 0 &&
+         fcntl(fd, F_SETLEASE, F_RDLCK) == 0;
+}
+
+// Maps regular files instead of reading them, so opening a file costs
+// no copy and unedited text is only paged in when it is looked at. The
+// text must not change under the pieces, so the mapping is backed by a
+// read lease: a process writing or truncating the file waits until
+// editor_poll_mapping() has copied the text. Files that cannot be leased,
+// e.g. someone else's or one that is open for writing, are read instead.
+static char* map_file(Editor* editor, FILE* file, size_t* size)
+{
+  if (getenv("JED_NO_MMAP") != NULL) {
+    return NULL;
+  }
+
+  struct stat st;
+  const int fd = fileno(file);
+  if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size <= 0) {
+    return NULL;
   }
 
-  fclose(f);
+  // The lease belongs to the open file, which has to outlive file
+  const int lease_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (lease_fd < 0) {
+    return NULL;
+  }
+  if (!take_lease(lease_fd)) {
+    close(lease_fd);
+    return NULL;
+  }
+
+  void* data =
+      mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    close(lease_fd);
+    return NULL;
+  }
+
+  editor->leased = true;
+  editor->lease_fd = lease_fd;
+  *size = (size_t)st.st_size;
+  return data;
 }
 
-void editor_load_from_file(Editor* editor, FILE* file)
+// Once another process wants to change the mapped file, copies the text
+// into memory of its own and lets that process go on. The copy is moved
+// over the mapping, so the text keeps its address and the threads reading
+// it never see it change.
+void editor_poll_mapping(Editor* editor)
 {
-  assert(editor->lines == NULL &&
+  if (!editor->leased || !lease_broken) {
+    return;
+  }
+  lease_broken = 0;
+
+  char* mapping = editor->pt.mapping;
+  const size_t size = editor->pt.mapping_size;
+  void* copy = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (copy == MAP_FAILED) {
+    fprintf(stderr,
+            "WARNING: could not copy the text before the file changed: "
+            "%s\n",
+            strerror(errno));
+  } else {
+    memcpy(copy, mapping, size);
+    mprotect(copy, size, PROT_READ);
+    if (mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, mapping) ==
+        MAP_FAILED) {
+      fprintf(stderr,
+              "WARNING: could not copy the text before the file changed: "
+              "%s\n",
+              strerror(errno));
+      munmap(copy, size);
+    }
+  }
+
+  fcntl(editor->lease_fd, F_SETLEASE, F_UNLCK);
+  close(editor->lease_fd);
+  editor->leased = false;
+}
+
+static Compress_Format detect_compression(FILE* file)
+{
+  const Compress_Format format = compress_detect(fileno(file));
+  if (format != COMPRESS_NONE && !compress_supported(format)) {
+    fprintf(stderr,
+            "WARNING: jed was built without %s support, showing the "
+            "file as it is\n",
+            compress_format_name(format));
+    return COMPRESS_NONE;
+  }
+  return format;
+}
+
+static char* reserve(size_t capacity)
+{
+  void* data = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return data == MAP_FAILED ? NULL : data;
+}
+
+// Reserves address space for the text of a compressed file, as much as
+// it could possibly decompress to. Pages only take memory once text is
+// written to them, and the text never has to move as it grows.
+static char* reserve_text(FILE* file, Compress_Format format,
+                          size_t* capacity)
+{
+  struct stat st;
+  if (fstat(fileno(file), &st) < 0) {
+    return NULL;
+  }
+  const size_t size = (size_t)st.st_size;
+  const size_t ratio = format != COMPRESS_NONE ? COMPRESS_MAX_RATIO : 1;
+  size_t bound = size > EDITOR_MAX_RESERVE / ratio ? EDITOR_MAX_RESERVE
+                                                   : size * ratio;
+  *capacity = bound;
+
+  // zstd can go way past any ratio, so it gets all the room there is.
+  // Where the system won't reserve that much, the size in the frame
+  // header will have to do.
+  if (format == COMPRESS_ZSTD) {
+    const size_t content = compress_content_size(fileno(file), format);
+    if (content > bound) {
+      bound = content < EDITOR_MAX_RESERVE ? content : EDITOR_MAX_RESERVE;
+    }
+    *capacity = EDITOR_MAX_RESERVE;
+  }
+  if (bound < EDITOR_MIN_RESERVE) {
+    bound = EDITOR_MIN_RESERVE;
+  }
+  if (*capacity < EDITOR_MIN_RESERVE) {
+    *capacity = EDITOR_MIN_RESERVE;
+  }
+
+  char* data = reserve(*capacity);
+  if (data == NULL && bound < *capacity) {
+    *capacity = bound;
+    data = reserve(*capacity);
+  }
+  return data;
+}
+
+// Gives back the reserved space past the text and makes the text
+// read-only, like a mapped file
+static void trim_text(char* data, size_t size, size_t capacity)
+{
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t used = (size + page - 1) / page * page;
+  if (used < capacity) {
+    munmap(data + used, capacity - used);
+  }
+  if (used > 0) {
+    mprotect(data, used, PROT_READ);
+  }
+}
+
+// Returns the text of a compressed file. What was decompressed before an
+// error is kept, with the error in editor->load_error.
+static char* inflate_file(Editor* editor, FILE* file, Compress_Format format,
+                          size_t* size)
+{
+  size_t capacity = 0;
+  *size = 0;
+  char* data = reserve_text(file, format, &capacity);
+  if (data == NULL) {
+    editor->load_error = errno;
+    return NULL;
+  }
+  if (!compress_inflate(fileno(file), format, data, capacity, NULL, NULL,
+                        size)) {
+    editor->load_error = errno;
+  }
+  trim_text(data, *size, capacity);
+  editor->compressed = format;
+  return data;
+}
+
+static void editor_load(Editor* editor, FILE* file, bool map)
+{
+  assert(editor->pt.buffers_size == 0 &&
          "You can only load files into an empty editor");
-  editor_create_first_new_line(editor);
 
-  static char chunk[640 * 1024];
+  const double begin = now_seconds();
+  const Compress_Format format = detect_compression(file);
+  size_t size = 0;
+  char* data = format != COMPRESS_NONE || !map
+                   ? NULL
+                   : map_file(editor, file, &size);
+  if (format != COMPRESS_NONE) {
+    // Nothing to show if not even the space for the text was there
+    data = inflate_file(editor, file, format, &size);
+    if (data != NULL) {
+      pt_load_mapping(&editor->pt, data, size);
+    }
+  } else if (data != NULL) {
+    pt_load_mapping(&editor->pt, data, size);
+  } else {
+    data = read_entire_file(file, &size);
+    pt_load_original(&editor->pt, data, size, true);
+  }
+  editor->load_seconds = now_seconds() - begin;
 
-  while (!feof(file)) {
-    size_t n = fread(chunk, 1, sizeof(chunk), file);
+  editor->cursor_row = 0;
+  editor->cursor_col = 0;
+}
 
-    String_View chunk_sv = {.data = chunk, .count = n};
+void editor_load_from_file(Editor* editor, FILE* file)
+{
+  editor_load(editor, file, true);
+}
 
-    while (chunk_sv.count > 0) {
-      String_View chunk_line = {0};
-      Line*       line = &editor->lines[editor->size - 1];
-      if (sv_try_chop_by_delim(&chunk_sv, '\n', &chunk_line)) {
-        line_append_text(line, chunk_line.data, chunk_line.count);
-        editor_insert_new_line(editor);
-      } else {
-        line_append_text(line, chunk_sv.data, chunk_sv.count);
-        chunk_sv = SV_NULL;
-      }
+// Like editor_load_from_file() but always copies the text, for files
+// expected to be truncated or rewritten while they are open, e.g. a
+// followed log rotated with copytruncate
+void editor_read_from_file(Editor* editor, FILE* file)
+{
+  editor_load(editor, file, false);
+}
+
+// Decompresses the file on one thread while another indexes the text
+// that is already there. Peak memory is the decompressed text. A file
+// that is not compressed but cannot be mapped safely is read the same
+// way.
+static void editor_start_inflating(Editor* editor, FILE* file,
+                                   Compress_Format format)
+{
+  size_t capacity = 0;
+  char* data = reserve_text(file, format, &capacity);
+  const int fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, 0);
+  if (data == NULL || fd < 0 ||
+      !loader_start_inflating(&editor->loader, fd, format, data,
+                              capacity)) {
+    if (data != NULL) {
+      munmap(data, capacity);
+    }
+    if (fd >= 0) {
+      close(fd);
     }
+    editor_load_from_file(editor, file);
+    return;
+  }
+
+  pt_begin_mapping(&editor->pt, data, capacity);
+  editor->compressed = format;
+  editor->reserved = capacity;
+  editor->cursor_row = 0;
+  editor->cursor_col = 0;
+}
+
+// Like editor_load_from_file() but returns as soon as the file is
+// mapped. The text is indexed on a background thread and shows up in the
+// editor through editor_poll_loading(); what is already there can be
+// viewed and edited in the meantime.
+void editor_start_loading(Editor* editor, const char* file_path, FILE* file)
+{
+  assert(editor->pt.buffers_size == 0 &&
+         "You can only load files into an empty editor");
+
+  editor->load_begin = now_seconds();
+  const Compress_Format format = detect_compression(file);
+  if (format != COMPRESS_NONE) {
+    editor_start_inflating(editor, file, format);
+    return;
+  }
+
+  size_t size = 0;
+  char* data = map_file(editor, file, &size);
+  if (data == NULL) {
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+      editor_start_inflating(editor, file, COMPRESS_NONE);
+    } else {
+      editor_load_from_file(editor, file);
+    }
+    return;
+  }
+
+  // A large file opened before has its line index cached
+  Lf_Index index = {0};
+  if (lf_cache_open(&editor->lf_cache, file_path, fileno(file), data,
+                    size) &&
+      lf_cache_load(&editor->lf_cache, &index)) {
+    pt_load_mapping_indexed(&editor->pt, data, size, &index);
+    editor->index_cached = true;
+    editor->load_seconds = now_seconds() - editor->load_begin;
+    editor->cursor_row = 0;
+    editor->cursor_col = 0;
+    return;
+  }
+
+  pt_begin_mapping(&editor->pt, data, size);
+  if (!loader_start(&editor->loader, data, size)) {
+    lf_index_scan_parallel(&index, data, 0, size);
+    pt_extend_original(&editor->pt, size, &index);
+    lf_index_free(&index);
+    lf_cache_store(&editor->lf_cache, &editor->pt.buffers[0].index);
+    editor->load_seconds = now_seconds() - editor->load_begin;
   }
 
   editor->cursor_row = 0;
+  editor->cursor_col = 0;
+}
+
+// Returns true while a load started by editor_start_loading() is still
+// in progress
+bool editor_poll_loading(Editor* editor)
+{
+  if (!editor->loader.running) {
+    return false;
+  }
+
+  if (loader_poll(&editor->loader, &editor->pt)) {
+    return true;
+  }
+  if (editor->loader.inflating) {
+    editor->load_error = editor->loader.error;
+    trim_text(editor->pt.mapping, editor->loader.size, editor->reserved);
+    editor->pt.mapping_size = editor->loader.size;
+  }
+  editor->load_seconds = now_seconds() - editor->load_begin;
+  watcher_set_disk(&editor->watcher, &editor->pt);
+  lf_cache_store(&editor->lf_cache, &editor->pt.buffers[0].index);
+  return false;
+}
+
+float editor_load_progress(const Editor* editor)
+{
+  return editor->loader.running ? loader_progress(&editor->loader) : 1.0f;
+}
+
+// Waits for the line index to be written to the cache, so that quitting
+// right after a load does not lose it
+void editor_close_cache(Editor* editor)
+{
+  lf_cache_close(&editor->lf_cache);
+}
+
+void editor_print_load_report(const Editor* editor, FILE* stream)
+{
+  const Pt_Stats stats = pt_stats(&editor->pt);
+  const size_t rows = editor_rows(editor);
+  const size_t total =
+      stats.text_bytes + stats.index_bytes + stats.node_bytes;
+
+  if (editor->pt.buffers_size > 0) {
+    const Lf_Index* index = &editor->pt.buffers[0].index;
+    char scan[64];
+    if (editor->index_cached) {
+      snprintf(scan, sizeof(scan), "line index from cache");
+    } else {
+      snprintf(scan, sizeof(scan), "%s newline scan on %zu threads",
+               lf_index_impl_name(),
+               lf_index_threads(editor->pt.buffers[0].size));
+    }
+    fprintf(stream,
+            "Loaded %zu bytes in %.3f s (%.2f GB/s, %s), %s line endings, "
+            "%zu non-ASCII lines\n",
+            editor->pt.buffers[0].size, editor->load_seconds,
+            editor->load_seconds > 0.0
+                ? (double)editor->pt.buffers[0].size / 1e9 /
+                      editor->load_seconds
+                : 0.0,
+            scan, lf_style_name(lf_index_style(index)),
+            lf_index_non_ascii_lines(index));
+  }
+
+  fprintf(stream,
+          "%zu lines: %zu bytes of text, %zu bytes of line index, "
+          "%zu bytes of nodes (%.1f bytes/line)\n",
+          rows, stats.text_bytes, stats.index_bytes, stats.node_bytes,
+          (double)total / (double)rows);
 }
@@ -3,34 +3,129 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "compress.h"
+#include "follow.h"
+#include "journal.h"
 #include "la.h"
+#include "lf_cache.h"
+#include "loader.h"
+#include "piece_table.h"
+#include "save.h"
+#include "saver.h"
+#include "stream.h"
+#include "undo.h"
+#include "watch.h"
 
+// Extra cursor of multi-cursor editing, selecting [anchor, offset)
 typedef struct {
-  size_t capacity;
-  size_t size;
-  char *chars;
-} Line;
-
-void line_append_text(Line *line, const char *text, size_t text_size);
-void line_insert_text_before(Line *line, const char *text, size_t text_size, size_t *col);
-void line_backspace(Line *line, size_t *col);
-void line_delete(Line *line, size_t *col);
+  size_t offset;
+  size_t anchor;
+} Editor_Cursor;
 
 typedef struct {
-    size_t capacity;
-    size_t size;
-    Line *lines;
-    size_t cursor_row;
-    size_t cursor_col;
+  Piece_Table pt;
+  size_t cursor_row;
+  size_t cursor_col;
+
+  // The selection runs between the anchor and the cursor
+  bool selection;
+  size_t anchor_row;
+  size_t anchor_col;
+
+  // Cursors besides the main one; edits apply at all of them
+  size_t cursors_capacity;
+  size_t cursors_size;
+  Editor_Cursor *cursors;
+
+  Undo undo;
+  Loader loader;
+  Saver saver;
+  Journal journal;
+  Watcher watcher;
+  Follower follower;
+  Streamer streamer;
+  double load_begin;
+  double load_seconds;
+  Lf_Cache lf_cache;
+  bool index_cached;
+
+  // Format of a compressed file. Its text, or that of a file that could
+  // not be mapped, is read into space reserved for it.
+  Compress_Format compressed;
+  size_t reserved;
+
+  // errno of a load that stopped part way, e.g. at corrupt data; the text
+  // up to there is kept
+  int load_error;
+
+  // Read lease keeping the mapped file from changing under the text
+  bool leased;
+  int lease_fd;
 } Editor;
 
-void editor_save_to_file(const Editor *editor, const char *file_path);
+bool editor_save_to_file(const Editor *editor, const char *file_path,
+                         Save_Result *result);
+bool editor_start_saving(Editor *editor, const char *file_path);
+bool editor_poll_saving(Editor *editor, Save_Result *result);
+bool editor_finish_saving(Editor *editor, Save_Result *result);
+bool editor_saving(const Editor *editor);
+float editor_save_progress(Editor *editor);
+size_t editor_open_journal(Editor *editor, const char *file_path);
+void editor_poll_journal(Editor *editor);
+void editor_close_journal(Editor *editor);
+void editor_start_watching(Editor *editor, const char *file_path);
+Watch_Event editor_poll_watching(Editor *editor);
+void editor_stop_watching(Editor *editor);
+void editor_start_following(Editor *editor, const char *file_path,
+                            FILE *file);
+Follow_Event editor_poll_following(Editor *editor);
+void editor_stop_following(Editor *editor);
+bool editor_start_streaming(Editor *editor, int fd);
+bool editor_poll_streaming(Editor *editor);
+bool editor_streaming(const Editor *editor);
+void editor_stop_streaming(Editor *editor);
 void editor_load_from_file(Editor *editor, FILE *file);
+void editor_read_from_file(Editor *editor, FILE *file);
+void editor_poll_mapping(Editor *editor);
+void editor_start_loading(Editor *editor, const char *file_path,
+                          FILE *file);
+bool editor_poll_loading(Editor *editor);
+float editor_load_progress(const Editor *editor);
+void editor_print_load_report(const Editor *editor, FILE *stream);
+void editor_close_cache(Editor *editor);
+
+size_t editor_rows(const Editor *editor);
+size_t editor_line_start(const Editor *editor, size_t row);
+size_t editor_line_size(const Editor *editor, size_t row);
+Pt_Iter editor_line_iter(const Editor *editor, size_t row, size_t first_col,
+                         size_t last_col);
 
 void editor_insert_text_before_cursor(Editor *editor, const char *text);
+void editor_insert_text(Editor *editor, const char *text, size_t text_size);
 void editor_insert_new_line(Editor *editor);
 void editor_backspace(Editor *editor);
 void editor_delete(Editor *editor);
 const char *editor_char_under_cursor(const Editor *editor);
 
+void editor_start_selection(Editor *editor);
+void editor_clear_selection(Editor *editor);
+bool editor_selection(const Editor *editor, size_t *begin, size_t *end);
+void editor_delete_range(Editor *editor, size_t begin, size_t end);
+void editor_replace_range(Editor *editor, size_t begin, size_t end,
+                          const char *text, size_t text_size);
+char *editor_copy_range(const Editor *editor, size_t begin, size_t end);
+char *editor_copy_selections(Editor *editor);
+void editor_cut_selections(Editor *editor);
+
+bool editor_add_cursor(Editor *editor, size_t offset, size_t anchor);
+void editor_duplicate_cursor(Editor *editor);
+void editor_clear_cursors(Editor *editor);
+size_t editor_select_occurrences(Editor *editor);
+
+Pt_Snapshot editor_snapshot(Editor *editor);
+void editor_release_snapshot(Editor *editor, Pt_Snapshot *snapshot);
+
+bool editor_undo(Editor *editor);
+bool editor_redo(Editor *editor);
+
 #endif // EDITOR_H_
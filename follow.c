@@ -0,0 +1,158 @@
+#include "./follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Follows the file open as fd from offset on. fd is taken over.
+bool follower_start(Follower* follower, const char* file_path, int fd,
+                    size_t offset)
+{
+  memset(follower, 0, sizeof(*follower));
+
+  struct stat st;
+  char* path = realpath(file_path, NULL);
+  if (path == NULL || fstat(fd, &st) < 0) {
+    free(path);
+    close(fd);
+    return false;
+  }
+  const char* slash = strrchr(path, '/');
+  char* dir = strndup(path, slash == path ? 1 : (size_t)(slash - path));
+
+  // Rotation renames the file away and creates a new one, so the
+  // directory is watched rather than the file
+  follower->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  const int wd = follower->inotify < 0
+                     ? -1
+                     : inotify_add_watch(follower->inotify, dir,
+                                         IN_MODIFY | IN_CREATE |
+                                             IN_MOVED_TO | IN_CLOSE_WRITE);
+  free(dir);
+  if (wd < 0) {
+    if (follower->inotify >= 0) {
+      close(follower->inotify);
+    }
+    free(path);
+    close(fd);
+    return false;
+  }
+
+  follower->file_path = path;
+  follower->name = strdup(slash + 1);
+  follower->fd = fd;
+  follower->inode = (uint64_t)st.st_ino;
+  follower->offset = offset;
+  follower->pending = true;
+  follower->chunk = malloc(FOLLOW_READ_CHUNK);
+  follower->running = true;
+  return true;
+}
+
+static bool follower_read_events(Follower* follower)
+{
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool matched = false;
+  while (true) {
+    const ssize_t n = read(follower->inotify, events, sizeof(events));
+    if (n <= 0) {
+      return matched;
+    }
+    for (ssize_t i = 0; i < n;) {
+      const struct inotify_event* event =
+          (const struct inotify_event*)(events + i);
+      if (event->len > 0 && strcmp(event->name, follower->name) == 0) {
+        matched = true;
+      }
+      i += (ssize_t)(sizeof(*event) + event->len);
+    }
+  }
+}
+
+// Appends up to limit bytes past the offset to the end of the text.
+// Returns false once the end of the file is reached.
+static bool follower_read(Follower* follower, Piece_Table* pt,
+                          size_t* appended, size_t limit)
+{
+  while (*appended < limit) {
+    const ssize_t n = pread(follower->fd, follower->chunk,
+                            FOLLOW_READ_CHUNK, (off_t)follower->offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    pt_insert(pt, pt->size, follower->chunk, (size_t)n);
+    follower->offset += (size_t)n;
+    *appended += (size_t)n;
+  }
+  return true;
+}
+
+// Appends to pt what was written to the file since the last poll, at
+// most FOLLOW_MAX_PER_POLL bytes at a time so a fast writer cannot
+// stall the caller. Only the new bytes are read and indexed.
+Follow_Event follower_poll(Follower* follower, Piece_Table* pt,
+                           size_t* appended)
+{
+  *appended = 0;
+  if (!follower->running) {
+    return FOLLOW_NONE;
+  }
+  if (follower_read_events(follower)) {
+    follower->pending = true;
+  }
+  if (!follower->pending) {
+    return FOLLOW_NONE;
+  }
+  follower->pending = false;
+
+  Follow_Event event = FOLLOW_NONE;
+  struct stat st;
+  if (fstat(follower->fd, &st) == 0 &&
+      (size_t)st.st_size < follower->offset) {
+    follower->offset = 0;
+    event = FOLLOW_TRUNCATED;
+  }
+  if (follower_read(follower, pt, appended, FOLLOW_MAX_PER_POLL)) {
+    follower->pending = true;
+    return event != FOLLOW_NONE ? event : FOLLOW_APPENDED;
+  }
+
+  // Switch to a new file at the path once the old one is read to its end
+  if (stat(follower->file_path, &st) == 0 &&
+      (uint64_t)st.st_ino != follower->inode) {
+    const int fd = open(follower->file_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      close(follower->fd);
+      follower->fd = fd;
+      follower->inode = (uint64_t)st.st_ino;
+      follower->offset = 0;
+      follower->pending = true;
+      event = FOLLOW_ROTATED;
+    }
+  }
+
+  if (event == FOLLOW_NONE && *appended > 0) {
+    event = FOLLOW_APPENDED;
+  }
+  return event;
+}
+
+void follower_stop(Follower* follower)
+{
+  if (!follower->running) {
+    return;
+  }
+  close(follower->fd);
+  close(follower->inotify);
+  free(follower->file_path);
+  free(follower->name);
+  free(follower->chunk);
+  memset(follower, 0, sizeof(*follower));
+}
@@ -0,0 +1,42 @@
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+#define FOLLOW_READ_CHUNK (4 * 1024 * 1024)
+#define FOLLOW_MAX_PER_POLL (64 * 1024 * 1024)
+
+typedef enum {
+  FOLLOW_NONE,
+  FOLLOW_APPENDED,
+  FOLLOW_TRUNCATED,
+  FOLLOW_ROTATED,
+} Follow_Event;
+
+// Reads what gets appended to a file, like tail -F. The file stays open,
+// and inotify events on it say when to read; only bytes past the end
+// already read are touched. A file that shrinks is read again from the
+// start, and one replaced by another file, e.g. by log rotation, is
+// read to its end before the new one is opened.
+typedef struct {
+  char* file_path;
+  char* name;
+  int fd;
+  uint64_t inode;
+  int inotify;
+  size_t offset;
+  bool pending;
+  char* chunk;
+  bool running;
+} Follower;
+
+bool follower_start(Follower* follower, const char* file_path, int fd,
+                    size_t offset);
+Follow_Event follower_poll(Follower* follower, Piece_Table* pt,
+                           size_t* appended);
+void follower_stop(Follower* follower);
+
+#endif  // FOLLOW_H_
@@ -0,0 +1,492 @@
+#include "./io.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_URING 1
+#endif
+#endif
+
+#ifdef IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Buffers registered with the kernel can't be bigger than this
+#define IO_FIXED_BUFFER (1024 * 1024 * 1024)
+#define IO_FIXED_BUFFERS 16384
+#endif
+
+// Moves iov past n bytes that were transferred
+static void io_advance(struct iovec** iov, size_t* count, size_t n)
+{
+  while (*count > 0 && n >= (*iov)->iov_len) {
+    n -= (*iov)->iov_len;
+    *iov += 1;
+    *count -= 1;
+  }
+  if (*count > 0) {
+    (*iov)->iov_base = (char*)(*iov)->iov_base + n;
+    (*iov)->iov_len -= n;
+  }
+}
+
+static bool io_pread_all(int fd, char* data, size_t offset, size_t size,
+                         size_t* read)
+{
+  *read = 0;
+  while (*read < size) {
+    const ssize_t n =
+        pread(fd, data + *read, size - *read, (off_t)(offset + *read));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    *read += (size_t)n;
+  }
+  return true;
+}
+
+static bool io_pwritev_all(int fd, struct iovec* iov, size_t count,
+                           size_t offset)
+{
+  while (count > 0) {
+    const ssize_t n = pwritev(fd, iov, (int)count, (off_t)offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    offset += (size_t)n;
+    io_advance(&iov, &count, (size_t)n);
+  }
+  return true;
+}
+
+#ifdef IO_URING
+
+static bool io_ring_init(Io_Ring* ring, unsigned entries)
+{
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  if (getenv("JED_NO_IO_URING") != NULL) {
+    return false;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return false;
+  }
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  ring->cq_ring = ring->sq_ring;
+  if (!single) {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_size);
+      close(fd);
+      return false;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (!single) {
+      munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(fd);
+    return false;
+  }
+
+  char* sq = ring->sq_ring;
+  char* cq = ring->cq_ring;
+  ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring->cqes = cq + params.cq_off.cqes;
+  ring->entries = params.sq_entries;
+  ring->fd = fd;
+  return true;
+}
+
+static void io_ring_free(Io_Ring* ring)
+{
+  if (ring->fd < 0) {
+    return;
+  }
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+// Queues one request and hands it to the kernel right away
+static bool io_ring_submit(Io_Ring* ring, const struct io_uring_sqe* sqe)
+{
+  const unsigned tail = *ring->sq_tail;
+  const unsigned index = tail & *ring->sq_mask;
+  ((struct io_uring_sqe*)ring->sqes)[index] = *sqe;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      return false;
+    }
+  }
+  ring->in_flight += 1;
+  return true;
+}
+
+// Waits for the next completion
+static bool io_ring_wait(Io_Ring* ring, struct io_uring_cqe* cqe)
+{
+  while (true) {
+    const unsigned head = *ring->cq_head;
+    if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      *cqe = ((struct io_uring_cqe*)ring->cqes)[head & *ring->cq_mask];
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      ring->in_flight -= 1;
+      return true;
+    }
+
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+// Pins data so the kernel can skip mapping the pages in on every read.
+// Fails when the memory lock limit is too low for it, which only costs
+// that speedup.
+static bool io_ring_register(Io_Ring* ring, char* data, size_t size)
+{
+  const size_t count = (size + IO_FIXED_BUFFER - 1) / IO_FIXED_BUFFER;
+  if (count > IO_FIXED_BUFFERS) {
+    return false;
+  }
+
+  struct iovec* iov = malloc(count * sizeof(iov[0]));
+  for (size_t i = 0; i < count; ++i) {
+    const size_t offset = i * IO_FIXED_BUFFER;
+    iov[i].iov_base = data + offset;
+    iov[i].iov_len = size - offset < IO_FIXED_BUFFER ? size - offset
+                                                     : IO_FIXED_BUFFER;
+  }
+  const bool ok = syscall(__NR_io_uring_register, ring->fd,
+                          IORING_REGISTER_BUFFERS, iov, count) == 0;
+  free(iov);
+  return ok;
+}
+
+typedef struct {
+  size_t offset;
+  size_t size;
+} Io_Chunk;
+
+static bool io_ring_read_chunk(Io_Ring* ring, int fd, char* data,
+                               size_t offset, bool fixed,
+                               const Io_Chunk* chunks, size_t slot)
+{
+  const Io_Chunk* chunk = &chunks[slot];
+  struct io_uring_sqe sqe;
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe.fd = fd;
+  sqe.off = offset + chunk->offset;
+  sqe.addr = (unsigned long)(data + chunk->offset);
+  sqe.len = (unsigned)chunk->size;
+  sqe.buf_index = (unsigned short)(chunk->offset / IO_FIXED_BUFFER);
+  sqe.user_data = slot;
+  return io_ring_submit(ring, &sqe);
+}
+
+// Reads IO_READ_CHUNK sized pieces of the file at once, each slot going
+// on with the next piece as soon as its read completes
+static bool io_ring_read(Io_Ring* ring, int fd, char* data, size_t offset,
+                         size_t size, size_t* read)
+{
+  // Pieces never straddle two fixed buffers
+  _Static_assert(IO_FIXED_BUFFER % IO_READ_CHUNK == 0,
+                 "Reads must not cross registered buffers");
+  const bool fixed = io_ring_register(ring, data, size);
+
+  Io_Chunk chunks[IO_QUEUE_DEPTH];
+  size_t end = size;
+  size_t next = 0;
+  int error = 0;
+  for (size_t slot = 0; slot < IO_QUEUE_DEPTH && next < end; ++slot) {
+    chunks[slot].offset = next;
+    chunks[slot].size = end - next < IO_READ_CHUNK ? end - next
+                                                   : IO_READ_CHUNK;
+    next += chunks[slot].size;
+    if (!io_ring_read_chunk(ring, fd, data, offset, fixed, chunks, slot)) {
+      error = errno;
+      break;
+    }
+  }
+
+  while (ring->in_flight > 0) {
+    struct io_uring_cqe cqe;
+    if (!io_ring_wait(ring, &cqe)) {
+      return false;
+    }
+
+    const size_t slot = (size_t)cqe.user_data;
+    Io_Chunk* chunk = &chunks[slot];
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+      // Tried again below
+    } else if (cqe.res < 0) {
+      error = -cqe.res;
+      continue;
+    } else if (cqe.res == 0) {
+      // The file got shorter since it was measured
+      if (chunk->offset < end) {
+        end = chunk->offset;
+      }
+      chunk->size = 0;
+    } else {
+      chunk->offset += (size_t)cqe.res;
+      chunk->size -= (size_t)cqe.res;
+    }
+
+    if (chunk->size == 0 && next < end) {
+      chunk->offset = next;
+      chunk->size = end - next < IO_READ_CHUNK ? end - next : IO_READ_CHUNK;
+      next += chunk->size;
+    }
+    if (error == 0 && chunk->size > 0 && chunk->offset < end &&
+        !io_ring_read_chunk(ring, fd, data, offset, fixed, chunks, slot)) {
+      error = errno;
+    }
+  }
+
+  if (error != 0) {
+    errno = error;
+    return false;
+  }
+  *read = end;
+  return true;
+}
+
+#else
+
+static bool io_ring_init(Io_Ring* ring, unsigned entries)
+{
+  (void)entries;
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  return false;
+}
+
+static void io_ring_free(Io_Ring* ring)
+{
+  (void)ring;
+}
+
+#endif  // IO_URING
+
+// Reads size bytes of the regular file fd from offset on into data with
+// several large reads in flight. Sets read to the number of bytes read,
+// which is less than size only if the file ends earlier.
+bool io_read(int fd, char* data, size_t offset, size_t size, size_t* read)
+{
+  Io_Ring ring;
+  if (size <= IO_READ_CHUNK || !io_ring_init(&ring, IO_QUEUE_DEPTH)) {
+    return io_pread_all(fd, data, offset, size, read);
+  }
+
+#ifdef IO_URING
+  const bool ok = io_ring_read(&ring, fd, data, offset, size, read);
+#else
+  const bool ok = false;
+#endif
+  const int error = errno;
+  io_ring_free(&ring);
+  errno = error;
+  return ok;
+}
+
+bool io_writer_init(Io_Writer* writer, int fd)
+{
+  memset(writer, 0, sizeof(*writer));
+  writer->fd = fd;
+  io_ring_init(&writer->ring, IO_QUEUE_DEPTH);
+
+  const size_t slots = writer->ring.fd >= 0 ? IO_QUEUE_DEPTH : 1;
+  writer->slots = malloc(slots * sizeof(writer->slots[0]));
+  for (size_t i = slots; i > 0; --i) {
+    writer->free_slots[writer->free_size++] = i - 1;
+  }
+  return true;
+}
+
+#ifdef IO_URING
+
+static bool io_writer_submit(Io_Writer* writer, size_t slot)
+{
+  const Io_Write* write = &writer->slots[slot];
+  struct io_uring_sqe sqe;
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_WRITEV;
+  sqe.fd = writer->fd;
+  sqe.off = write->offset;
+  sqe.addr = (unsigned long)write->iov;
+  sqe.len = (unsigned)write->count;
+  sqe.user_data = slot;
+  if (!io_ring_submit(&writer->ring, &sqe)) {
+    writer->error = errno;
+    return false;
+  }
+  return true;
+}
+
+// Takes one completion, writing the rest of a short write again.
+// Returns false if there was none to take.
+static bool io_writer_reap(Io_Writer* writer)
+{
+  struct io_uring_cqe cqe;
+  if (!io_ring_wait(&writer->ring, &cqe)) {
+    writer->error = errno;
+    return false;
+  }
+
+  const size_t slot = (size_t)cqe.user_data;
+  Io_Write* write = &writer->slots[slot];
+  if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+    // Tried again below
+  } else if (cqe.res <= 0) {
+    writer->error = cqe.res < 0 ? -cqe.res : EIO;
+    writer->free_slots[writer->free_size++] = slot;
+    return true;
+  } else {
+    const size_t n = (size_t)cqe.res;
+    writer->written += n;
+    write->offset += n;
+    write->size -= n;
+    struct iovec* iov = write->iov;
+    io_advance(&iov, &write->count, n);
+    memmove(write->iov, iov, write->count * sizeof(iov[0]));
+  }
+
+  if (write->size == 0 || writer->error != 0 ||
+      !io_writer_submit(writer, slot)) {
+    writer->free_slots[writer->free_size++] = slot;
+  }
+  return true;
+}
+
+#endif  // IO_URING
+
+// Appends the chunks of iov to the file. With io_uring the write is only
+// queued: the chunks must stay valid until io_writer_finish().
+bool io_writer_write(Io_Writer* writer, const struct iovec* iov,
+                     size_t count)
+{
+  if (writer->error != 0) {
+    errno = writer->error;
+    return false;
+  }
+  if (count > IO_WRITE_IOVS) {
+    errno = EINVAL;
+    return false;
+  }
+
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size += iov[i].iov_len;
+  }
+
+#ifdef IO_URING
+  if (writer->ring.fd >= 0) {
+    while (writer->free_size == 0 && writer->error == 0 &&
+           io_writer_reap(writer)) {
+    }
+    if (writer->error != 0) {
+      errno = writer->error;
+      return false;
+    }
+
+    const size_t slot = writer->free_slots[--writer->free_size];
+    Io_Write* write = &writer->slots[slot];
+    write->offset = writer->offset;
+    write->size = size;
+    write->count = count;
+    memcpy(write->iov, iov, count * sizeof(iov[0]));
+    writer->offset += size;
+    if (!io_writer_submit(writer, slot)) {
+      writer->free_slots[writer->free_size++] = slot;
+      errno = writer->error;
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  Io_Write* write = &writer->slots[0];
+  memcpy(write->iov, iov, count * sizeof(iov[0]));
+  if (!io_pwritev_all(writer->fd, write->iov, count, writer->offset)) {
+    writer->error = errno;
+    return false;
+  }
+  writer->offset += size;
+  writer->written += size;
+  return true;
+}
+
+// Waits for the writes in flight. Returns false with errno set if any of
+// them failed.
+bool io_writer_finish(Io_Writer* writer)
+{
+#ifdef IO_URING
+  while (writer->ring.fd >= 0 && writer->ring.in_flight > 0 &&
+         io_writer_reap(writer)) {
+  }
+#endif
+
+  io_ring_free(&writer->ring);
+  free(writer->slots);
+  writer->slots = NULL;
+  if (writer->error != 0) {
+    errno = writer->error;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,62 @@
+#ifndef IO_H_
+#define IO_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#define IO_QUEUE_DEPTH 8
+#define IO_READ_CHUNK (4 * 1024 * 1024)
+#define IO_WRITE_IOVS 1024
+
+// Submission and completion rings of an io_uring, fd is -1 when the
+// kernel does not have one to offer
+typedef struct {
+  int fd;
+  unsigned entries;
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  void* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  void* cqes;
+  unsigned in_flight;
+} Io_Ring;
+
+// A write of up to IO_WRITE_IOVS chunks that is in flight
+typedef struct {
+  size_t offset;
+  size_t size;
+  size_t count;
+  struct iovec iov[IO_WRITE_IOVS];
+} Io_Write;
+
+// Writes a file front to back with up to IO_QUEUE_DEPTH writes in
+// flight, or one pwritev() at a time without io_uring
+typedef struct {
+  int fd;
+  Io_Ring ring;
+  size_t offset;
+  size_t written;
+  int error;
+  Io_Write* slots;
+  size_t free_slots[IO_QUEUE_DEPTH];
+  size_t free_size;
+} Io_Writer;
+
+bool io_read(int fd, char* data, size_t offset, size_t size, size_t* read);
+
+bool io_writer_init(Io_Writer* writer, int fd);
+bool io_writer_write(Io_Writer* writer, const struct iovec* iov,
+                     size_t count);
+bool io_writer_finish(Io_Writer* writer);
+
+#endif  // IO_H_
@@ -0,0 +1,736 @@
+#include "./journal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_INIT_CAPACITY 64
+#define JOURNAL_FNV_OFFSET 0xcbf29ce484222325ULL
+#define JOURNAL_FNV_PRIME 0x100000001b3ULL
+
+static uint64_t journal_hash(uint64_t hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * JOURNAL_FNV_PRIME;
+  }
+  return hash;
+}
+
+// The journal of dir/name is dir/.name.jed-journal, next to the file a
+// symlink points to
+static char* journal_path_of(const char* file_path)
+{
+  char* real_path = realpath(file_path, NULL);
+  const char* path = real_path != NULL ? real_path : file_path;
+  const char* slash = strrchr(path, '/');
+  const int dir_size = slash != NULL ? (int)(slash - path + 1) : 0;
+  const char* name = slash != NULL ? slash + 1 : path;
+
+  const size_t size = strlen(path) + 32;
+  char* journal_path = malloc(size);
+  snprintf(journal_path, size, "%.*s.%s.jed-journal", dir_size, path, name);
+  free(real_path);
+  return journal_path;
+}
+
+// Identifies the file as it is on disk. A file that does not exist yet
+// is all zeros.
+static Journal_Header journal_identify(const char* file_path)
+{
+  Journal_Header header = {0};
+  memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+
+  struct stat st;
+  if (stat(file_path, &st) == 0) {
+    header.size = (uint64_t)st.st_size;
+    header.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    header.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    header.inode = (uint64_t)st.st_ino;
+  }
+  return header;
+}
+
+bool journal_exists(const char* file_path)
+{
+  char* path = journal_path_of(file_path);
+  const bool exists = access(path, F_OK) == 0;
+  free(path);
+  return exists;
+}
+
+// Parses the record at data[*at] and, if apply is set, applies it to pt.
+// Returns false at the end of the journal: a record cut short by a crash
+// or one that does not fit the text.
+static bool journal_apply(Piece_Table* pt, const char* data, size_t size,
+                          size_t* at, bool apply)
+{
+  const size_t begin = *at;
+  Journal_Record record;
+  if (size - *at < sizeof(record)) {
+    return false;
+  }
+  memcpy(&record, data + *at, sizeof(record));
+  *at += sizeof(record);
+  if (record.offset > pt->size ||
+      record.removed > pt->size - record.offset) {
+    return false;
+  }
+
+  const bool original =
+      pt->buffers_size > 0 && pt->buffers[0].capacity == 0;
+  const size_t original_size = original ? pt->buffers[0].size : 0;
+  if (apply) {
+    pt_delete(pt, record.offset, record.removed);
+  }
+
+  size_t offset = record.offset;
+  for (uint64_t i = 0; i < record.chunks; ++i) {
+    Journal_Piece piece;
+    if (size - *at < sizeof(piece)) {
+      return false;
+    }
+    memcpy(&piece, data + *at, sizeof(piece));
+    *at += sizeof(piece);
+
+    if (piece.start == JOURNAL_INLINE) {
+      if (size - *at < piece.size) {
+        return false;
+      }
+      if (apply) {
+        pt_insert(pt, offset, data + *at, piece.size);
+      }
+      *at += piece.size;
+    } else {
+      if (!original || piece.start > original_size ||
+          piece.size > original_size - piece.start) {
+        return false;
+      }
+      if (apply) {
+        pt_insert_piece(pt, offset,
+                        pt_piece(pt, 0, piece.start, piece.size));
+      }
+    }
+    offset += piece.size;
+  }
+
+  uint64_t hash;
+  if (size - *at < sizeof(hash)) {
+    return false;
+  }
+  memcpy(&hash, data + *at, sizeof(hash));
+  *at += sizeof(hash);
+  return hash ==
+         journal_hash(JOURNAL_FNV_OFFSET, data + begin, *at - begin - 8);
+}
+
+// Applies the edits of a journal left behind by a session that did not
+// end cleanly to pt, which holds the whole file. Returns the number of
+// edits replayed. A journal of another version of the file can't be
+// replayed; it is moved aside with a warning instead of being lost.
+size_t journal_replay(const char* file_path, Piece_Table* pt)
+{
+  char* path = journal_path_of(file_path);
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 ||
+      (size_t)st.st_size < sizeof(Journal_Header)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(path);
+    return 0;
+  }
+
+  const size_t size = (size_t)st.st_size;
+  char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    free(path);
+    return 0;
+  }
+
+  const Journal_Header expected = journal_identify(file_path);
+  if (memcmp(data, &expected, sizeof(expected)) != 0) {
+    char old_path[PATH_MAX + 64];
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    rename(path, old_path);
+    fprintf(stderr,
+            "WARNING: `%s` changed since its journal was written, moved "
+            "the journal to `%s`\n",
+            file_path, old_path);
+    munmap(data, size);
+    free(path);
+    return 0;
+  }
+
+  // Every record is checked before it is applied, so a torn one at the
+  // end leaves the text as it was after the last complete one
+  size_t count = 0;
+  size_t at = sizeof(Journal_Header);
+  while (at < size) {
+    size_t next = at;
+    if (!journal_apply(pt, data, size, &next, false)) {
+      break;
+    }
+    journal_apply(pt, data, size, &at, true);
+    count += 1;
+  }
+
+  munmap(data, size);
+  free(path);
+  return count;
+}
+
+// Output of the journal thread, buffered and hashed on the way out
+typedef struct {
+  int fd;
+  size_t offset;
+  uint64_t hash;
+  bool failed;
+  size_t size;
+  char data[JOURNAL_WRITE_BUFFER];
+} Journal_Writer;
+
+static bool journal_write_all(int fd, const char* data, size_t size)
+{
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+static void journal_flush(Journal_Writer* w)
+{
+  if (!w->failed && !journal_write_all(w->fd, w->data, w->size)) {
+    w->failed = true;
+  }
+  w->size = 0;
+}
+
+static void journal_emit(Journal_Writer* w, const void* data, size_t size)
+{
+  w->hash = journal_hash(w->hash, data, size);
+  w->offset += size;
+  if (size > sizeof(w->data) - w->size) {
+    journal_flush(w);
+  }
+  if (size > sizeof(w->data)) {
+    if (!w->failed && !journal_write_all(w->fd, data, size)) {
+      w->failed = true;
+    }
+    return;
+  }
+  memcpy(w->data + w->size, data, size);
+  w->size += size;
+}
+
+static void journal_emit_chunk(Journal_Writer* w, const Journal* journal,
+                               bool refs, const char* data, size_t size)
+{
+  Journal_Piece piece = {.start = JOURNAL_INLINE, .size = size};
+  if (refs && journal->original != NULL && data >= journal->original &&
+      data < journal->original + journal->original_size) {
+    piece.start = (uint64_t)(data - journal->original);
+  }
+  journal_emit(w, &piece, sizeof(piece));
+  if (piece.start == JOURNAL_INLINE) {
+    journal_emit(w, data, size);
+  }
+}
+
+static void journal_emit_hash(Journal_Writer* w)
+{
+  const uint64_t hash = w->hash;
+  journal_emit(w, &hash, sizeof(hash));
+}
+
+// Writes ops, the first of which is op number first. Notes where the op
+// marked at the start of a save begins, see journal_begin_save().
+static void journal_emit_ops(Journal_Writer* w, const Journal* journal,
+                             const Journal_Op* ops, size_t ops_size,
+                             const Journal_Chunk* chunks, size_t first,
+                             size_t mark, size_t* mark_offset)
+{
+  for (size_t i = 0; i <= ops_size; ++i) {
+    if (*mark_offset == SIZE_MAX && first + i == mark) {
+      *mark_offset = w->offset;
+    }
+    if (i == ops_size) {
+      break;
+    }
+
+    const Journal_Op* op = &ops[i];
+    const Journal_Record record = {
+        .offset = op->offset,
+        .removed = op->removed,
+        .chunks = op->chunks,
+    };
+    w->hash = JOURNAL_FNV_OFFSET;
+    journal_emit(w, &record, sizeof(record));
+    for (size_t j = 0; j < op->chunks; ++j) {
+      journal_emit_chunk(w, journal, op->refs, chunks[j].data,
+                         chunks[j].size);
+    }
+    journal_emit_hash(w);
+    chunks += op->chunks;
+  }
+}
+
+// The whole text as one record that replaces the text of the file
+static void journal_emit_checkpoint(Journal_Writer* w,
+                                    const Journal* journal,
+                                    const Pt_Snapshot* snapshot, bool refs,
+                                    uint64_t base_size)
+{
+  Journal_Record record = {.removed = base_size};
+  Pt_Iter it = pt_snapshot_iter(snapshot, 0, snapshot->size);
+  String_View chunk = {0};
+  while (pt_iter_next(&it, &chunk)) {
+    record.chunks += 1;
+  }
+
+  w->hash = JOURNAL_FNV_OFFSET;
+  journal_emit(w, &record, sizeof(record));
+  it = pt_snapshot_iter(snapshot, 0, snapshot->size);
+  while (pt_iter_next(&it, &chunk)) {
+    journal_emit_chunk(w, journal, refs, chunk.data, chunk.count);
+  }
+  journal_emit_hash(w);
+}
+
+static void journal_sync_directory(const char* path)
+{
+  char dir[PATH_MAX];
+  const char* slash = strrchr(path, '/');
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else if ((size_t)(slash - path) < sizeof(dir)) {
+    memcpy(dir, path, (size_t)(slash - path));
+    dir[slash - path] = '\0';
+  } else {
+    return;
+  }
+
+  const int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+// Work the thread took from the editor in one go
+typedef struct {
+  Journal_Op* ops;
+  size_t ops_size;
+  Journal_Chunk* chunks;
+  size_t first;
+  const Pt_Snapshot* snapshot;
+  bool refs;
+  bool rebase;
+  Journal_Header base;
+} Journal_Batch;
+
+// Replaces the journal by a new one made of the header of base, the
+// checkpoint if any, the tail of the old journal from copy_from on and
+// the ops of the batch. Like saving, this goes through a temporary file
+// so the old journal stays valid until the new one is complete.
+static bool journal_rewrite(Journal* journal, Journal_Writer* w,
+                            const Journal_Batch* batch, size_t copy_from,
+                            size_t mark, size_t* mark_offset)
+{
+  char temp[PATH_MAX + 64];
+  snprintf(temp, sizeof(temp), "%s.tmp", journal->path);
+  const int old_fd = w->fd;
+  const size_t old_size = w->offset;
+
+  w->fd = open(temp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (w->fd < 0) {
+    w->fd = old_fd;
+    return false;
+  }
+  w->offset = 0;
+  w->size = 0;
+  w->failed = false;
+
+  journal_emit(w, &batch->base, sizeof(batch->base));
+  if (batch->snapshot != NULL) {
+    journal_emit_checkpoint(w, journal, batch->snapshot, batch->refs,
+                            batch->base.size);
+  }
+
+  // Records written after the mark only need a new header to apply to
+  // the saved file
+  if (old_fd >= 0 && copy_from < old_size) {
+    journal_flush(w);
+    char buffer[64 * 1024];
+    size_t at = copy_from;
+    while (!w->failed && at < old_size) {
+      const size_t n = old_size - at < sizeof(buffer) ? old_size - at
+                                                      : sizeof(buffer);
+      const ssize_t got = pread(old_fd, buffer, n, (off_t)at);
+      if (got <= 0) {
+        w->failed = true;
+        break;
+      }
+      w->failed = !journal_write_all(w->fd, buffer, (size_t)got);
+      at += (size_t)got;
+    }
+    w->offset += old_size - copy_from;
+  }
+
+  journal_emit_ops(w, journal, batch->ops, batch->ops_size, batch->chunks,
+                   batch->first, mark, mark_offset);
+  journal_flush(w);
+
+  if (w->failed || fsync(w->fd) < 0 || rename(temp, journal->path) < 0) {
+    close(w->fd);
+    unlink(temp);
+    w->fd = old_fd;
+    w->offset = old_size;
+    return false;
+  }
+  if (old_fd >= 0) {
+    close(old_fd);
+  }
+  journal_sync_directory(journal->path);
+  return true;
+}
+
+static void journal_process(Journal* journal, Journal_Writer* w,
+                            const Journal_Batch* batch, size_t* mark,
+                            size_t* mark_offset, bool* broken)
+{
+  if (*broken) {
+    return;
+  }
+
+  bool ok = true;
+  if (batch->snapshot != NULL || batch->rebase) {
+    size_t copy_from = SIZE_MAX;
+    Journal_Batch rest = *batch;
+    if (batch->rebase && w->fd >= 0 && batch->snapshot == NULL) {
+      journal_emit_ops(w, journal, batch->ops, batch->ops_size,
+                       batch->chunks, batch->first, *mark, mark_offset);
+      journal_flush(w);
+      assert(*mark_offset != SIZE_MAX);
+      copy_from = *mark_offset;
+      rest.ops_size = 0;
+      *mark = SIZE_MAX;
+    }
+    *mark_offset = SIZE_MAX;
+    ok = !w->failed &&
+         journal_rewrite(journal, w, &rest, copy_from, *mark, mark_offset);
+  } else if (batch->ops_size > 0) {
+    journal_emit_ops(w, journal, batch->ops, batch->ops_size, batch->chunks,
+                     batch->first, *mark, mark_offset);
+    journal_flush(w);
+    ok = !w->failed && fdatasync(w->fd) == 0;
+  }
+
+  if (!ok) {
+    fprintf(stderr,
+            "ERROR: could not write journal `%s`: %s; edits are no longer "
+            "journaled\n",
+            journal->path, strerror(errno));
+    *broken = true;
+  }
+}
+
+static void* journal_run(void* arg)
+{
+  Journal* journal = arg;
+  Journal_Writer* w = malloc(sizeof(*w));
+  w->fd = -1;
+  w->offset = 0;
+  w->size = 0;
+  w->failed = false;
+
+  // The queues are swapped with these, so the editor never waits for a
+  // write to finish
+  size_t ops_capacity = 0;
+  Journal_Op* ops = NULL;
+  size_t chunks_capacity = 0;
+  Journal_Chunk* chunks = NULL;
+  size_t mark = SIZE_MAX;
+  size_t mark_offset = SIZE_MAX;
+  bool broken = false;
+
+  pthread_mutex_lock(&journal->mutex);
+  while (true) {
+    if (!journal->stop && !journal->rebase &&
+        !(journal->checkpoint && !journal->checkpoint_done)) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += JOURNAL_COMMIT_SECONDS;
+      pthread_cond_timedwait(&journal->cond, &journal->mutex, &deadline);
+    }
+
+    Journal_Batch batch = {
+        .ops = journal->ops,
+        .ops_size = journal->ops_size,
+        .chunks = journal->chunks,
+        .first = journal->ops_taken,
+        .refs = journal->checkpoint_refs,
+        .rebase = journal->rebase,
+        .base = journal->base,
+    };
+    if (journal->checkpoint && !journal->checkpoint_done) {
+      batch.snapshot = &journal->snapshot;
+    }
+    if (journal->mark_set) {
+      mark = journal->mark;
+      mark_offset = SIZE_MAX;
+      journal->mark_set = false;
+    }
+    const bool stop = journal->stop;
+    const size_t batch_ops_capacity = journal->ops_capacity;
+    const size_t batch_chunks_capacity = journal->chunks_capacity;
+
+    journal->ops_taken += journal->ops_size;
+    journal->ops = ops;
+    journal->ops_capacity = ops_capacity;
+    journal->ops_size = 0;
+    journal->chunks = chunks;
+    journal->chunks_capacity = chunks_capacity;
+    journal->chunks_size = 0;
+    pthread_mutex_unlock(&journal->mutex);
+
+    journal_process(journal, w, &batch, &mark, &mark_offset, &broken);
+    ops = batch.ops;
+    ops_capacity = batch_ops_capacity;
+    chunks = batch.chunks;
+    chunks_capacity = batch_chunks_capacity;
+
+    pthread_mutex_lock(&journal->mutex);
+    if (batch.snapshot != NULL) {
+      journal->checkpoint_done = true;
+    }
+    if (batch.snapshot != NULL || batch.rebase) {
+      journal->checkpoint_size = w->offset;
+    }
+    if (batch.rebase) {
+      journal->rebase = false;
+    }
+    journal->file_size = w->offset;
+    pthread_cond_broadcast(&journal->cond);
+    if (stop && journal->ops_size == 0) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&journal->mutex);
+
+  if (w->fd >= 0) {
+    close(w->fd);
+  }
+  free(ops);
+  free(chunks);
+  free(w);
+  return NULL;
+}
+
+// Starts journaling the edits of pt, the text of file_path, in a new
+// journal that replaces any old one. With checkpoint set the journal
+// starts with the current text, e.g. after replaying the old journal, so
+// the replayed edits are not lost until the next save.
+bool journal_start(Journal* journal, const char* file_path,
+                   Piece_Table* pt, bool checkpoint)
+{
+  memset(journal, 0, sizeof(*journal));
+  if (pthread_mutex_init(&journal->mutex, NULL) != 0) {
+    return false;
+  }
+  if (pthread_cond_init(&journal->cond, NULL) != 0) {
+    pthread_mutex_destroy(&journal->mutex);
+    return false;
+  }
+
+  journal->path = journal_path_of(file_path);
+  journal->file_path = strdup(file_path);
+  if (pt->buffers_size > 0 && pt->buffers[0].capacity == 0) {
+    journal->original = pt->buffers[0].data;
+    journal->original_size =
+        pt->mapping != NULL ? pt->mapping_size : pt->buffers[0].size;
+  }
+  journal->original_is_base = true;
+  journal->base = journal_identify(file_path);
+  journal->rebase = true;
+  if (checkpoint) {
+    journal->checkpoint = true;
+    journal->checkpoint_refs = true;
+    journal->snapshot = pt_snapshot(pt);
+  }
+
+  if (pthread_create(&journal->thread, NULL, journal_run, journal) != 0) {
+    if (checkpoint) {
+      pt_snapshot_release(pt, &journal->snapshot);
+    }
+    free(journal->path);
+    free(journal->file_path);
+    pthread_cond_destroy(&journal->cond);
+    pthread_mutex_destroy(&journal->mutex);
+    return false;
+  }
+  journal->running = true;
+  return true;
+}
+
+// Queues the edit that replaced the removed bytes at offset with the text
+// of pieces. Only pointers to the text are queued: buffer data never
+// moves or changes once written.
+void journal_splice(Journal* journal, const Piece_Table* pt, size_t offset,
+                    size_t removed, const Piece* pieces, size_t count)
+{
+  if (!journal->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&journal->mutex);
+  if (journal->ops_size >= journal->ops_capacity) {
+    journal->ops_capacity = journal->ops_capacity == 0
+                                ? JOURNAL_INIT_CAPACITY
+                                : journal->ops_capacity * 2;
+    journal->ops = realloc(journal->ops,
+                           journal->ops_capacity * sizeof(journal->ops[0]));
+  }
+  while (journal->chunks_size + count > journal->chunks_capacity) {
+    journal->chunks_capacity = journal->chunks_capacity == 0
+                                   ? JOURNAL_INIT_CAPACITY
+                                   : journal->chunks_capacity * 2;
+    journal->chunks =
+        realloc(journal->chunks,
+                journal->chunks_capacity * sizeof(journal->chunks[0]));
+  }
+
+  // Text of the file being saved won't be there to refer to if the
+  // save succeeds
+  journal->ops[journal->ops_size++] = (Journal_Op){
+      .offset = offset,
+      .removed = removed,
+      .chunks = count,
+      .refs = journal->original_is_base && !journal->saving,
+  };
+  for (size_t i = 0; i < count; ++i) {
+    journal->chunks[journal->chunks_size++] = (Journal_Chunk){
+        .data = pt->buffers[pieces[i].buffer].data + pieces[i].start,
+        .size = pieces[i].size,
+    };
+  }
+  journal->ops_appended += 1;
+  pthread_mutex_unlock(&journal->mutex);
+}
+
+// Releases the snapshot of a finished checkpoint and, if compact is set,
+// starts a new one once the journal has grown past twice the size of the
+// last one. Called by the thread that owns pt, regularly.
+void journal_poll(Journal* journal, Piece_Table* pt, bool compact)
+{
+  if (!journal->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&journal->mutex);
+  if (journal->checkpoint_done) {
+    pt_snapshot_release(pt, &journal->snapshot);
+    journal->checkpoint = false;
+    journal->checkpoint_done = false;
+  }
+
+  // The checkpoint covers the queued edits, they are dropped
+  if (compact && !journal->checkpoint && !journal->rebase &&
+      !journal->saving &&
+      journal->file_size > JOURNAL_COMPACT_BYTES &&
+      journal->file_size > 2 * journal->checkpoint_size) {
+    journal->snapshot = pt_snapshot(pt);
+    journal->checkpoint = true;
+    journal->checkpoint_refs = journal->original_is_base;
+    journal->ops_taken += journal->ops_size;
+    journal->ops_size = 0;
+    journal->chunks_size = 0;
+    pthread_cond_broadcast(&journal->cond);
+  }
+  pthread_mutex_unlock(&journal->mutex);
+}
+
+// Marks where the text being saved ends in the journal. Once the save
+// succeeds, the edits after the mark are all the journal needs to keep.
+void journal_begin_save(Journal* journal)
+{
+  if (!journal->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&journal->mutex);
+  while (journal->rebase) {
+    pthread_cond_wait(&journal->cond, &journal->mutex);
+  }
+  journal->mark = journal->ops_appended;
+  journal->mark_set = true;
+  journal->saving = true;
+  pthread_mutex_unlock(&journal->mutex);
+}
+
+void journal_end_save(Journal* journal, bool saved)
+{
+  if (!journal->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&journal->mutex);
+  journal->saving = false;
+  if (saved) {
+    journal->original_is_base = false;
+    journal->base = journal_identify(journal->file_path);
+    journal->rebase = true;
+    pthread_cond_broadcast(&journal->cond);
+  }
+  pthread_mutex_unlock(&journal->mutex);
+}
+
+// Writes out the queued edits and stops the thread. A journal without
+// edits since the file was saved is removed; one with edits is kept so
+// they show up again on the next open.
+void journal_stop(Journal* journal, Piece_Table* pt)
+{
+  if (!journal->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&journal->mutex);
+  journal->stop = true;
+  pthread_cond_broadcast(&journal->cond);
+  pthread_mutex_unlock(&journal->mutex);
+  pthread_join(journal->thread, NULL);
+
+  if (journal->checkpoint) {
+    pt_snapshot_release(pt, &journal->snapshot);
+  }
+  if (journal->file_size == sizeof(Journal_Header)) {
+    unlink(journal->path);
+  }
+
+  pthread_cond_destroy(&journal->cond);
+  pthread_mutex_destroy(&journal->mutex);
+  free(journal->ops);
+  free(journal->chunks);
+  free(journal->path);
+  free(journal->file_path);
+  memset(journal, 0, sizeof(*journal));
+}
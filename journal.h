@@ -0,0 +1,112 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+#define JOURNAL_MAGIC "jedjrnl1"
+#define JOURNAL_COMMIT_SECONDS 1
+#define JOURNAL_COMPACT_BYTES (4 * 1024 * 1024)
+#define JOURNAL_WRITE_BUFFER (1024 * 1024)
+
+// Starts every journal and names the file the edits apply to, as it was
+// on disk when the journal was started or last saved
+typedef struct {
+  char magic[8];
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;
+} Journal_Header;
+
+// Followed by chunks pieces of text that replace the removed bytes at
+// offset, and by the hash of the whole record
+typedef struct {
+  uint64_t offset;
+  uint64_t removed;
+  uint64_t chunks;
+} Journal_Record;
+
+// Text of a record: either size bytes of the file at start, or, when
+// start is JOURNAL_INLINE, the size bytes that follow
+typedef struct {
+  uint64_t start;
+  uint64_t size;
+} Journal_Piece;
+
+#define JOURNAL_INLINE UINT64_MAX
+
+typedef struct {
+  size_t offset;
+  size_t removed;
+  size_t chunks;
+
+  // Whether text of the original file may be stored as a reference
+  bool refs;
+} Journal_Op;
+
+typedef struct {
+  const char* data;
+  size_t size;
+} Journal_Chunk;
+
+// Append-only log of the edits made since the file was opened or saved,
+// kept next to the file so that a crash loses at most the last
+// JOURNAL_COMMIT_SECONDS of work. The editor queues the edits, which
+// only costs a few stores per keystroke, and a background thread writes
+// and syncs the queue once per commit interval. Once the journal has
+// outgrown the text it describes, it is rewritten from a snapshot as a
+// single checkpoint record.
+typedef struct {
+  char* path;
+  char* file_path;
+  const char* original;
+  size_t original_size;
+  bool original_is_base;
+  bool saving;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  // Queued by the editor, taken by the thread
+  size_t ops_capacity;
+  size_t ops_size;
+  Journal_Op* ops;
+  size_t chunks_capacity;
+  size_t chunks_size;
+  Journal_Chunk* chunks;
+  size_t ops_taken;
+  size_t ops_appended;
+
+  bool checkpoint;
+  bool checkpoint_done;
+  bool checkpoint_refs;
+  Pt_Snapshot snapshot;
+  bool rebase;
+  Journal_Header base;
+  bool mark_set;
+  size_t mark;
+  bool stop;
+
+  // Reported by the thread
+  size_t file_size;
+  size_t checkpoint_size;
+} Journal;
+
+bool journal_exists(const char* file_path);
+size_t journal_replay(const char* file_path, Piece_Table* pt);
+bool journal_start(Journal* journal, const char* file_path,
+                   Piece_Table* pt, bool checkpoint);
+void journal_splice(Journal* journal, const Piece_Table* pt, size_t offset,
+                    size_t removed, const Piece* pieces, size_t count);
+void journal_poll(Journal* journal, Piece_Table* pt, bool compact);
+void journal_begin_save(Journal* journal);
+void journal_end_save(Journal* journal, bool saved);
+void journal_stop(Journal* journal, Piece_Table* pt);
+
+#endif  // JOURNAL_H_
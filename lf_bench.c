@@ -0,0 +1,93 @@
+// Times the line scanner of lf_index.c on synthetic text. The scanner is
+// the fastest one the CPU runs unless JED_LF_SCAN picks another, see
+// `make bench`.
+//
+//   ./lf_bench [MiB]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lf_index.h"
+
+#define LF_BENCH_DEFAULT_MIB 256
+#define LF_BENCH_ROUNDS 5
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// Lines of up to 160 bytes, a few of them ending in CRLF or holding a
+// UTF-8 character, like source code or logs
+static void fill_text(char* data, size_t size)
+{
+  uint64_t state = 0x9e3779b97f4a7c15;
+  size_t i = 0;
+  while (i < size) {
+    const uint64_t r = next_random(&state);
+    size_t line = r % 161;
+    if (line > size - i) {
+      line = size - i;
+    }
+    for (size_t j = 0; j < line; ++j) {
+      data[i + j] = (char)(' ' + (r >> (j % 48)) % 95);
+    }
+    if (line >= 2 && (r >> 56) % 16 == 0) {
+      memcpy(data + i + line / 2, "\xc3\xa9", 2);
+    }
+    i += line;
+    if (i < size && line > 0 && (r >> 60) == 0) {
+      data[i - 1] = '\r';
+    }
+    if (i < size) {
+      data[i++] = '\n';
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t mib = argc > 1 ? strtoull(argv[1], NULL, 10)
+                              : LF_BENCH_DEFAULT_MIB;
+  const size_t size = (mib > 0 ? mib : 1) * 1024 * 1024;
+  char* data = malloc(size);
+  if (data == NULL) {
+    fprintf(stderr, "ERROR: could not allocate %zu MiB\n", mib);
+    return 1;
+  }
+  fill_text(data, size);
+
+  // Best of a few rounds, after one that warms up the caches and the
+  // allocator
+  double best = 0.0;
+  size_t lines = 0;
+  for (int round = 0; round <= LF_BENCH_ROUNDS; ++round) {
+    Lf_Index index = {0};
+    const double begin = now_seconds();
+    lf_index_scan(&index, data, 0, size);
+    const double seconds = now_seconds() - begin;
+    lines = index.lfs_size + 1;
+    lf_index_free(&index);
+    if (round > 0 && (best == 0.0 || seconds < best)) {
+      best = seconds;
+    }
+  }
+
+  printf("%-6s %zu MiB, %zu lines: %.2f ms, %.2f GB/s\n",
+         lf_index_impl_name(), size / (1024 * 1024), lines, best * 1e3,
+         (double)size / best / 1e9);
+  free(data);
+  return 0;
+}
@@ -0,0 +1,377 @@
+#include "./lf_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LF_CACHE_FNV_OFFSET 0xcbf29ce484222325ULL
+#define LF_CACHE_FNV_PRIME 0x100000001b3ULL
+#define LF_CACHE_SUFFIX ".lfc"
+
+typedef struct {
+  char* path;
+  uint64_t size;
+  int64_t mtime;
+} Lf_Cache_Entry;
+
+static uint64_t lf_cache_hash(uint64_t hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * LF_CACHE_FNV_PRIME;
+  }
+  return hash;
+}
+
+// Cheap enough to check on every load, unlike a byte-wise hash
+static uint64_t lf_cache_checksum(uint64_t sum, const uint64_t* words,
+                                  size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    sum = (sum + words[i]) * LF_CACHE_FNV_PRIME;
+  }
+  return sum;
+}
+
+// $XDG_CACHE_HOME/jed, or ~/.cache/jed
+static char* lf_cache_dir(void)
+{
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  char dir[PATH_MAX];
+  int n = -1;
+  if (xdg != NULL && xdg[0] == '/') {
+    n = snprintf(dir, sizeof(dir), "%s/jed", xdg);
+  } else if (home != NULL && home[0] != '\0') {
+    n = snprintf(dir, sizeof(dir), "%s/.cache/jed", home);
+  }
+  if (n < 0 || (size_t)n >= sizeof(dir)) {
+    return NULL;
+  }
+  return strdup(dir);
+}
+
+static bool lf_cache_make_dirs(const char* path)
+{
+  char dir[PATH_MAX];
+  const char* slash = strrchr(path, '/');
+  if (slash == NULL || (size_t)(slash - path) >= sizeof(dir)) {
+    return false;
+  }
+  memcpy(dir, path, (size_t)(slash - path));
+  dir[slash - path] = '\0';
+
+  for (char* p = dir + 1; *p != '\0'; ++p) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return false;
+      }
+      *p = '/';
+    }
+  }
+  return mkdir(dir, 0700) == 0 || errno == EEXIST;
+}
+
+static bool lf_cache_read(int fd, void* data, size_t size, size_t offset)
+{
+  char* bytes = data;
+  while (size > 0) {
+    const ssize_t n = pread(fd, bytes, size, (off_t)offset);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += n;
+    size -= (size_t)n;
+    offset += (size_t)n;
+  }
+  return true;
+}
+
+static bool lf_cache_write(int fd, const void* data, size_t size)
+{
+  const char* bytes = data;
+  while (size > 0) {
+    const ssize_t n = write(fd, bytes, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+// Keys the cache for the file open as fd, whose size bytes are mapped at
+// data. Only reads the LF_CACHE_SAMPLES blocks, whatever the size of the
+// file. Returns false for files too small to be worth caching.
+bool lf_cache_open(Lf_Cache* cache, const char* file_path, int fd,
+                   const char* data, size_t size)
+{
+  memset(cache, 0, sizeof(*cache));
+  struct stat st;
+  if (size < LF_CACHE_MIN_SIZE || fstat(fd, &st) < 0 ||
+      (size_t)st.st_size != size) {
+    return false;
+  }
+
+  char* dir = lf_cache_dir();
+  cache->file_path = realpath(file_path, NULL);
+  if (dir == NULL || cache->file_path == NULL) {
+    free(dir);
+    free(cache->file_path);
+    cache->file_path = NULL;
+    return false;
+  }
+
+  const size_t path_size = strlen(cache->file_path);
+  const size_t cache_path_size = strlen(dir) + 32;
+  cache->path = malloc(cache_path_size);
+  snprintf(cache->path, cache_path_size, "%s/%016llx" LF_CACHE_SUFFIX, dir,
+           (unsigned long long)lf_cache_hash(LF_CACHE_FNV_OFFSET,
+                                             cache->file_path, path_size));
+  free(dir);
+
+  Lf_Cache_Header* header = &cache->header;
+  memcpy(header->magic, LF_CACHE_MAGIC, sizeof(header->magic));
+  header->size = (uint64_t)size;
+  header->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  header->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+  header->inode = (uint64_t)st.st_ino;
+  header->device = (uint64_t)st.st_dev;
+  header->path_size = (uint64_t)path_size;
+
+  uint64_t hash = LF_CACHE_FNV_OFFSET;
+  for (size_t i = 0; i < LF_CACHE_SAMPLES; ++i) {
+    const size_t at =
+        (size - LF_CACHE_SAMPLE_SIZE) / (LF_CACHE_SAMPLES - 1) * i;
+    hash = lf_cache_hash(hash, data + at, LF_CACHE_SAMPLE_SIZE);
+  }
+  header->sample_hash = lf_cache_hash(
+      hash, data + size - LF_CACHE_SAMPLE_SIZE, LF_CACHE_SAMPLE_SIZE);
+  return true;
+}
+
+// Reads the cached index of the file if its key still matches. The line
+// ends are checked to be in order and within the file, and everything
+// against the checksum, so a damaged cache is ignored rather than
+// trusted.
+bool lf_cache_load(Lf_Cache* cache, Lf_Index* index)
+{
+  if (cache->path == NULL) {
+    return false;
+  }
+  const int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  const Lf_Cache_Header* key = &cache->header;
+  Lf_Cache_Header header;
+  struct stat st;
+  char* path = malloc(key->path_size);
+  Lf_Index loaded = {0};
+  bool ok = fstat(fd, &st) == 0 &&
+            lf_cache_read(fd, &header, sizeof(header), 0) &&
+            memcmp(&header, key, offsetof(Lf_Cache_Header, lfs_size)) ==
+                0 &&
+            header.lfs_size <= header.size &&
+            (uint64_t)st.st_size ==
+                sizeof(header) + header.path_size +
+                    (header.lfs_size + header.non_ascii_size) * 8 &&
+            lf_cache_read(fd, path, key->path_size, sizeof(header)) &&
+            memcmp(path, cache->file_path, key->path_size) == 0;
+
+  if (ok) {
+    const size_t at = sizeof(header) + key->path_size;
+    loaded.lfs_capacity = loaded.lfs_size = header.lfs_size;
+    loaded.lfs = malloc(loaded.lfs_size * sizeof(loaded.lfs[0]));
+    loaded.crlf_count = header.crlf_count;
+    loaded.non_ascii_capacity = header.non_ascii_size;
+    loaded.non_ascii =
+        malloc(loaded.non_ascii_capacity * sizeof(loaded.non_ascii[0]));
+    ok = lf_cache_read(fd, loaded.lfs,
+                       loaded.lfs_size * sizeof(loaded.lfs[0]), at) &&
+         lf_cache_read(
+             fd, loaded.non_ascii,
+             loaded.non_ascii_capacity * sizeof(loaded.non_ascii[0]),
+             at + loaded.lfs_size * sizeof(loaded.lfs[0]));
+  }
+  for (size_t i = 0; ok && i < loaded.lfs_size; ++i) {
+    ok = loaded.lfs[i] < header.size &&
+         (i == 0 || loaded.lfs[i - 1] < loaded.lfs[i]);
+  }
+  ok = ok && lf_cache_checksum(
+                 lf_cache_checksum(LF_CACHE_FNV_OFFSET,
+                                   (const uint64_t*)loaded.lfs,
+                                   loaded.lfs_size),
+                 loaded.non_ascii,
+                 loaded.non_ascii_capacity) == header.checksum;
+
+  if (ok) {
+    // Marks the index as recently used
+    futimens(fd, NULL);
+    *index = loaded;
+  } else {
+    lf_index_free(&loaded);
+  }
+  free(path);
+  close(fd);
+  return ok;
+}
+
+static int lf_cache_compare_entries(const void* a, const void* b)
+{
+  const int64_t x = ((const Lf_Cache_Entry*)a)->mtime;
+  const int64_t y = ((const Lf_Cache_Entry*)b)->mtime;
+  return (x > y) - (x < y);
+}
+
+// Drops the least recently used indexes until the cache fits in
+// LF_CACHE_MAX_BYTES, keeping the one just written
+static void lf_cache_evict(const char* keep)
+{
+  const char* slash = strrchr(keep, '/');
+  char dir_path[PATH_MAX];
+  if (slash == NULL || (size_t)(slash - keep) >= sizeof(dir_path)) {
+    return;
+  }
+  memcpy(dir_path, keep, (size_t)(slash - keep));
+  dir_path[slash - keep] = '\0';
+
+  DIR* dir = opendir(dir_path);
+  if (dir == NULL) {
+    return;
+  }
+
+  size_t entries_capacity = 0;
+  size_t entries_size = 0;
+  Lf_Cache_Entry* entries = NULL;
+  uint64_t total = 0;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != NULL) {
+    const size_t n = strlen(ent->d_name);
+    const size_t suffix = sizeof(LF_CACHE_SUFFIX) - 1;
+    if (n <= suffix ||
+        strcmp(ent->d_name + n - suffix, LF_CACHE_SUFFIX) != 0) {
+      continue;
+    }
+
+    const size_t path_size = strlen(dir_path) + n + 2;
+    char* path = malloc(path_size);
+    snprintf(path, path_size, "%s/%s", dir_path, ent->d_name);
+    struct stat st;
+    if (stat(path, &st) < 0) {
+      free(path);
+      continue;
+    }
+    total += (uint64_t)st.st_size;
+    if (strcmp(path, keep) == 0) {
+      free(path);
+      continue;
+    }
+
+    if (entries_size >= entries_capacity) {
+      entries_capacity = entries_capacity == 0 ? 16 : entries_capacity * 2;
+      entries = realloc(entries, entries_capacity * sizeof(entries[0]));
+    }
+    entries[entries_size++] = (Lf_Cache_Entry){
+        .path = path,
+        .size = (uint64_t)st.st_size,
+        .mtime = (int64_t)st.st_mtim.tv_sec,
+    };
+  }
+  closedir(dir);
+
+  if (entries_size > 0) {
+    qsort(entries, entries_size, sizeof(entries[0]),
+          lf_cache_compare_entries);
+  }
+  for (size_t i = 0; i < entries_size; ++i) {
+    if (total > LF_CACHE_MAX_BYTES && unlink(entries[i].path) == 0) {
+      total -= entries[i].size;
+    }
+    free(entries[i].path);
+  }
+  free(entries);
+}
+
+// Writes to a temporary file renamed into place, so that a reader never
+// sees half an index
+static void* lf_cache_run(void* arg)
+{
+  Lf_Cache* cache = arg;
+  const Lf_Index* index = &cache->index;
+  if (!lf_cache_make_dirs(cache->path)) {
+    return NULL;
+  }
+
+  const size_t temp_size = strlen(cache->path) + 32;
+  char* temp = malloc(temp_size);
+  snprintf(temp, temp_size, "%s.%ld.tmp", cache->path, (long)getpid());
+  const int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    free(temp);
+    return NULL;
+  }
+
+  Lf_Cache_Header header = cache->header;
+  header.lfs_size = index->lfs_size;
+  header.crlf_count = index->crlf_count;
+  header.non_ascii_size = index->non_ascii_capacity;
+  header.checksum = lf_cache_checksum(
+      lf_cache_checksum(LF_CACHE_FNV_OFFSET, (const uint64_t*)index->lfs,
+                        index->lfs_size),
+      index->non_ascii, index->non_ascii_capacity);
+  bool ok =
+      lf_cache_write(fd, &header, sizeof(header)) &&
+      lf_cache_write(fd, cache->file_path, header.path_size) &&
+      lf_cache_write(fd, index->lfs,
+                     index->lfs_size * sizeof(index->lfs[0])) &&
+      lf_cache_write(fd, index->non_ascii,
+                     index->non_ascii_capacity * sizeof(index->non_ascii[0]));
+  ok = close(fd) == 0 && ok;
+
+  if (ok && rename(temp, cache->path) == 0) {
+    lf_cache_evict(cache->path);
+  } else {
+    unlink(temp);
+  }
+  free(temp);
+  return NULL;
+}
+
+// Starts writing index to the cache. The index is only borrowed: it must
+// stay as it is until lf_cache_close().
+void lf_cache_store(Lf_Cache* cache, const Lf_Index* index)
+{
+  if (cache->path == NULL || cache->running) {
+    return;
+  }
+  cache->index = *index;
+  if (pthread_create(&cache->thread, NULL, lf_cache_run, cache) == 0) {
+    cache->running = true;
+  }
+}
+
+void lf_cache_close(Lf_Cache* cache)
+{
+  if (cache->running) {
+    pthread_join(cache->thread, NULL);
+  }
+  free(cache->path);
+  free(cache->file_path);
+  memset(cache, 0, sizeof(*cache));
+}
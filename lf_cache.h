@@ -0,0 +1,57 @@
+#ifndef LF_CACHE_H_
+#define LF_CACHE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "lf_index.h"
+
+#define LF_CACHE_MAGIC "jedlfc01"
+#define LF_CACHE_MIN_SIZE (64 * 1024 * 1024)
+#define LF_CACHE_MAX_BYTES ((uint64_t)4 * 1024 * 1024 * 1024)
+#define LF_CACHE_SAMPLES 64
+#define LF_CACHE_SAMPLE_SIZE 4096
+
+// Starts every cached index. The key names the file the index was made
+// for: its size, mtime and inode, plus a hash of LF_CACHE_SAMPLES blocks
+// spread over the text to catch changes that kept the mtime.
+typedef struct {
+  char magic[8];
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;
+  uint64_t device;
+  uint64_t sample_hash;
+  uint64_t path_size;
+
+  uint64_t lfs_size;
+  uint64_t crlf_count;
+  uint64_t non_ascii_size;
+  uint64_t checksum;
+} Lf_Cache_Header;
+
+// Line index of a large file kept in $XDG_CACHE_HOME/jed, so that opening
+// the file again skips the newline scan. The header is followed by the
+// real path of the file, the line ends and the non-ASCII bits. Indexes
+// are written on a background thread once a load is done, and the least
+// recently used ones are dropped once the cache outgrows
+// LF_CACHE_MAX_BYTES.
+typedef struct {
+  char* path;
+  char* file_path;
+  Lf_Cache_Header header;
+
+  pthread_t thread;
+  bool running;
+  Lf_Index index;
+} Lf_Cache;
+
+bool lf_cache_open(Lf_Cache* cache, const char* file_path, int fd,
+                   const char* data, size_t size);
+bool lf_cache_load(Lf_Cache* cache, Lf_Index* index);
+void lf_cache_store(Lf_Cache* cache, const Lf_Index* index);
+void lf_cache_close(Lf_Cache* cache);
+
+#endif  // LF_CACHE_H_
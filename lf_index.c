@@ -0,0 +1,458 @@
+#include "./lf_index.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LF_INDEX_X86
+#endif
+
+#define LF_INDEX_INIT_CAPACITY 1024
+#define LF_INDEX_PARALLEL_CHUNK (16 * 1024 * 1024)
+#define LF_INDEX_MAX_THREADS 64
+
+static void lf_index_reserve(Lf_Index* index, size_t n)
+{
+  if (index->lfs_capacity - index->lfs_size >= n) {
+    return;
+  }
+
+  size_t new_capacity = index->lfs_capacity == 0 ? LF_INDEX_INIT_CAPACITY
+                                                 : index->lfs_capacity;
+  while (new_capacity - index->lfs_size < n) {
+    new_capacity *= 2;
+  }
+  index->lfs = realloc(index->lfs, new_capacity * sizeof(index->lfs[0]));
+  index->lfs_capacity = new_capacity;
+}
+
+static void lf_index_mark_line(Lf_Index* index, size_t line)
+{
+  if (line / 64 >= index->non_ascii_capacity) {
+    size_t new_capacity = index->non_ascii_capacity * 2;
+    if (new_capacity <= line / 64) {
+      new_capacity = line / 64 + 1;
+    }
+    index->non_ascii = realloc(index->non_ascii,
+                               new_capacity * sizeof(index->non_ascii[0]));
+    memset(index->non_ascii + index->non_ascii_capacity, 0,
+           (new_capacity - index->non_ascii_capacity) *
+               sizeof(index->non_ascii[0]));
+    index->non_ascii_capacity = new_capacity;
+  }
+  index->non_ascii[line / 64] |= (uint64_t)1 << (line % 64);
+}
+
+static void lf_index_mark_non_ascii(Lf_Index* index)
+{
+  lf_index_mark_line(index, index->lfs_size);
+}
+
+static void lf_index_scan_scalar(Lf_Index* index, const char* data,
+                                 size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; ++i) {
+    if (data[i] == '\n') {
+      lf_index_reserve(index, 1);
+      index->lfs[index->lfs_size++] = i;
+      if (i > 0 && data[i - 1] == '\r') {
+        index->crlf_count += 1;
+      }
+    } else if ((unsigned char)data[i] >= 0x80) {
+      lf_index_mark_non_ascii(index);
+    }
+  }
+}
+
+#ifdef LF_INDEX_X86
+// Handles one block of width bytes at data[i] given the masks of its
+// '\n' and '\r' bytes.
+static inline void lf_index_push_mask(Lf_Index* index, const char* data,
+                                      size_t i, uint32_t lf_mask,
+                                      uint32_t cr_mask)
+{
+  if (lf_mask == 0) {
+    return;
+  }
+
+  // A '\r' right before the block pairs with a '\n' in its first byte
+  const uint32_t cr_before = (i > 0 && data[i - 1] == '\r') ? 1 : 0;
+  index->crlf_count +=
+      (size_t)__builtin_popcount(lf_mask & ((cr_mask << 1) | cr_before));
+
+  lf_index_reserve(index, 32);
+  size_t* out = index->lfs + index->lfs_size;
+  while (lf_mask != 0) {
+    *out++ = i + (size_t)__builtin_ctz(lf_mask);
+    lf_mask &= lf_mask - 1;
+  }
+  index->lfs_size = (size_t)(out - index->lfs);
+}
+
+// Blocks without any byte >= 0x80 only need their '\n' positions, which
+// come straight out of the compare mask. Blocks with non-ASCII bytes are
+// rare and go through the scalar loop to attribute them to their lines.
+__attribute__((target("sse2"))) static void lf_index_scan_sse2(
+    Lf_Index* index, const char* data, size_t begin, size_t end)
+{
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  size_t i = begin;
+  for (; i + 16 <= end; i += 16) {
+    const __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+    if (_mm_movemask_epi8(block) != 0) {
+      lf_index_scan_scalar(index, data, i, i + 16);
+      continue;
+    }
+    lf_index_push_mask(
+        index, data, i,
+        (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf)),
+        (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, cr)));
+  }
+  lf_index_scan_scalar(index, data, i, end);
+}
+
+__attribute__((target("avx2"))) static void lf_index_scan_avx2(
+    Lf_Index* index, const char* data, size_t begin, size_t end)
+{
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  size_t i = begin;
+  for (; i + 32 <= end; i += 32) {
+    const __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+    if (_mm256_movemask_epi8(block) != 0) {
+      lf_index_scan_scalar(index, data, i, i + 32);
+      continue;
+    }
+    lf_index_push_mask(
+        index, data, i,
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf)),
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, cr)));
+  }
+  lf_index_scan_sse2(index, data, i, end);
+}
+#endif
+
+typedef void (*Lf_Index_Scan_Fn)(Lf_Index* index, const char* data,
+                                 size_t begin, size_t end);
+
+static Lf_Index_Scan_Fn lf_index_scan_fn = NULL;
+static const char* lf_index_scan_name = NULL;
+static pthread_once_t lf_index_once = PTHREAD_ONCE_INIT;
+
+// JED_LF_SCAN=sse2 or scalar picks a slower scanner than the CPU could
+// run, e.g. to compare them
+static void lf_index_detect(void)
+{
+#ifdef LF_INDEX_X86
+  const char* scan = getenv("JED_LF_SCAN");
+  const bool scalar = scan != NULL && strcmp(scan, "scalar") == 0;
+  const bool sse2 = scan != NULL && strcmp(scan, "sse2") == 0;
+  __builtin_cpu_init();
+  if (!scalar && !sse2 && __builtin_cpu_supports("avx2")) {
+    lf_index_scan_name = "avx2";
+    lf_index_scan_fn = lf_index_scan_avx2;
+    return;
+  }
+  if (!scalar && __builtin_cpu_supports("sse2")) {
+    lf_index_scan_name = "sse2";
+    lf_index_scan_fn = lf_index_scan_sse2;
+    return;
+  }
+#endif
+
+  lf_index_scan_name = "scalar";
+  lf_index_scan_fn = lf_index_scan_scalar;
+}
+
+static void lf_index_select(void)
+{
+  pthread_once(&lf_index_once, lf_index_detect);
+}
+
+// Indexes data[start, start + size), which must directly follow whatever
+// was scanned into index before.
+void lf_index_scan(Lf_Index* index, const char* data, size_t start,
+                   size_t size)
+{
+  lf_index_select();
+  lf_index_scan_fn(index, data, start, start + size);
+}
+
+size_t lf_index_threads(size_t size)
+{
+  size_t threads = size / LF_INDEX_PARALLEL_CHUNK;
+  if (threads <= 1) {
+    return 1;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0 && threads > (size_t)cpus) {
+    threads = (size_t)cpus;
+  }
+  if (threads > LF_INDEX_MAX_THREADS) {
+    threads = LF_INDEX_MAX_THREADS;
+  }
+  return threads;
+}
+
+// Smallest range lf_index_scan_parallel() spreads over every thread
+size_t lf_index_parallel_size(void)
+{
+  return lf_index_threads(SIZE_MAX) * LF_INDEX_PARALLEL_CHUNK;
+}
+
+typedef struct {
+  Lf_Index index;
+  const char* data;
+  size_t start;
+  size_t size;
+} Lf_Index_Job;
+
+static void lf_index_job_run(Lf_Index_Job* job)
+{
+  lf_index_scan_fn(&job->index, job->data, job->start,
+                   job->start + job->size);
+}
+
+// Workers started on the first parallel scan and kept for the rest of
+// the program. A scan posts its jobs here; the workers and the thread
+// that posted them take the jobs one by one until none are left.
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  Lf_Index_Job* jobs;
+  size_t jobs_size;
+  size_t next;
+  size_t finished;
+} Lf_Index_Pool;
+
+static Lf_Index_Pool lf_index_pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t lf_index_pool_once = PTHREAD_ONCE_INIT;
+
+// Held by the scan that owns the pool; other scans run on their own
+// thread meanwhile
+static pthread_mutex_t lf_index_pool_owner = PTHREAD_MUTEX_INITIALIZER;
+
+// Runs the jobs of the pool that are not taken yet. Called and returns
+// with the mutex of the pool held.
+static void lf_index_pool_work(Lf_Index_Pool* pool)
+{
+  while (pool->next < pool->jobs_size) {
+    Lf_Index_Job* job = &pool->jobs[pool->next++];
+    pthread_mutex_unlock(&pool->mutex);
+    lf_index_job_run(job);
+    pthread_mutex_lock(&pool->mutex);
+    if (++pool->finished == pool->jobs_size) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+}
+
+static void* lf_index_worker(void* arg)
+{
+  Lf_Index_Pool* pool = arg;
+  pthread_mutex_lock(&pool->mutex);
+  while (true) {
+    while (pool->next >= pool->jobs_size) {
+      pthread_cond_wait(&pool->work, &pool->mutex);
+    }
+    lf_index_pool_work(pool);
+  }
+  return NULL;
+}
+
+// One worker per CPU besides the thread that posts the jobs. Workers
+// that cannot be started leave more of the jobs to that thread.
+static void lf_index_pool_start(void)
+{
+  const size_t workers = lf_index_threads(SIZE_MAX) - 1;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (size_t i = 0; i < workers; ++i) {
+    pthread_t worker;
+    pthread_create(&worker, &attr, lf_index_worker, &lf_index_pool);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// Runs jobs on the pool and returns once all of them are done
+static void lf_index_pool_run(Lf_Index_Job* jobs, size_t jobs_size)
+{
+  pthread_once(&lf_index_pool_once, lf_index_pool_start);
+
+  Lf_Index_Pool* pool = &lf_index_pool;
+  pthread_mutex_lock(&pool->mutex);
+  pool->jobs = jobs;
+  pool->jobs_size = jobs_size;
+  pool->next = 0;
+  pool->finished = 0;
+  pthread_cond_broadcast(&pool->work);
+
+  lf_index_pool_work(pool);
+  while (pool->finished < pool->jobs_size) {
+    pthread_cond_wait(&pool->done, &pool->mutex);
+  }
+  pool->jobs = NULL;
+  pool->jobs_size = 0;
+  pool->next = 0;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+// Appends the line table of part, which indexed the bytes right after
+// everything index has seen so far. The first line of part continues the
+// last open line of index.
+void lf_index_append(Lf_Index* index, const Lf_Index* part)
+{
+  const size_t base = index->lfs_size;
+
+  if (part->lfs_size > 0) {
+    lf_index_reserve(index, part->lfs_size);
+    memcpy(index->lfs + index->lfs_size, part->lfs,
+           part->lfs_size * sizeof(part->lfs[0]));
+    index->lfs_size += part->lfs_size;
+  }
+  index->crlf_count += part->crlf_count;
+
+  for (size_t i = 0; i < part->non_ascii_capacity; ++i) {
+    uint64_t word = part->non_ascii[i];
+    while (word != 0) {
+      const size_t bit = (size_t)__builtin_ctzll(word);
+      lf_index_mark_line(index, base + i * 64 + bit);
+      word &= word - 1;
+    }
+  }
+}
+
+// Splits data[start, start + size) into one chunk per thread of the
+// pool, indexes the chunks concurrently and stitches their tables
+// together in order. Chunk boundaries need no special care: a '\r'
+// ending one chunk is still visible to the scan of the next one through
+// data. A scan that finds the pool busy with another one runs alone.
+void lf_index_scan_parallel(Lf_Index* index, const char* data, size_t start,
+                            size_t size)
+{
+  lf_index_select();
+
+  const size_t threads = lf_index_threads(size);
+  if (threads <= 1 || pthread_mutex_trylock(&lf_index_pool_owner) != 0) {
+    lf_index_scan_fn(index, data, start, start + size);
+    return;
+  }
+
+  Lf_Index_Job jobs[LF_INDEX_MAX_THREADS];
+  memset(jobs, 0, sizeof(jobs));
+  const size_t chunk = size / threads;
+  for (size_t i = 0; i < threads; ++i) {
+    jobs[i].data = data;
+    jobs[i].start = start + i * chunk;
+    jobs[i].size = i + 1 < threads ? chunk : size - i * chunk;
+  }
+  lf_index_pool_run(jobs, threads);
+  pthread_mutex_unlock(&lf_index_pool_owner);
+
+  for (size_t i = 0; i < threads; ++i) {
+    lf_index_append(index, &jobs[i].index);
+    lf_index_free(&jobs[i].index);
+  }
+}
+
+void lf_index_shrink(Lf_Index* index)
+{
+  if (index->lfs_capacity > index->lfs_size) {
+    index->lfs_capacity = index->lfs_size;
+    index->lfs =
+        realloc(index->lfs, index->lfs_capacity * sizeof(index->lfs[0]));
+  }
+}
+
+void lf_index_free(Lf_Index* index)
+{
+  free(index->lfs);
+  free(index->non_ascii);
+  memset(index, 0, sizeof(*index));
+}
+
+// Index of the first '\n' located at or after offset
+size_t lf_index_lower_bound(const Lf_Index* index, size_t offset)
+{
+  size_t lo = 0;
+  size_t hi = index->lfs_size;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->lfs[mid] < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+Lf_Style lf_index_style(const Lf_Index* index)
+{
+  if (index->lfs_size == 0) {
+    return LF_STYLE_NONE;
+  }
+  if (index->crlf_count == 0) {
+    return LF_STYLE_LF;
+  }
+  if (index->crlf_count == index->lfs_size) {
+    return LF_STYLE_CRLF;
+  }
+  return LF_STYLE_MIXED;
+}
+
+bool lf_index_line_is_ascii(const Lf_Index* index, size_t line)
+{
+  if (line / 64 >= index->non_ascii_capacity) {
+    return true;
+  }
+  return (index->non_ascii[line / 64] & ((uint64_t)1 << (line % 64))) == 0;
+}
+
+size_t lf_index_non_ascii_lines(const Lf_Index* index)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < index->non_ascii_capacity; ++i) {
+    count += (size_t)__builtin_popcountll(index->non_ascii[i]);
+  }
+  return count;
+}
+
+size_t lf_index_bytes(const Lf_Index* index)
+{
+  return index->lfs_capacity * sizeof(index->lfs[0]) +
+         index->non_ascii_capacity * sizeof(index->non_ascii[0]);
+}
+
+const char* lf_index_impl_name(void)
+{
+  lf_index_select();
+  return lf_index_scan_name;
+}
+
+const char* lf_style_name(Lf_Style style)
+{
+  switch (style) {
+  case LF_STYLE_NONE:
+    return "none";
+  case LF_STYLE_LF:
+    return "LF";
+  case LF_STYLE_CRLF:
+    return "CRLF";
+  case LF_STYLE_MIXED:
+    return "mixed";
+  }
+  assert(0 && "unreachable");
+  return "(unknown)";
+}
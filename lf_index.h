@@ -0,0 +1,49 @@
+#ifndef LF_INDEX_H_
+#define LF_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+  LF_STYLE_NONE = 0,
+  LF_STYLE_LF,
+  LF_STYLE_CRLF,
+  LF_STYLE_MIXED,
+} Lf_Style;
+
+// Line table of a buffer. Line i ends at lfs[i]; the last line runs to
+// the end of the buffer.
+typedef struct {
+  size_t lfs_capacity;
+  size_t lfs_size;
+  size_t* lfs;
+
+  // Number of '\n' preceded by '\r'
+  size_t crlf_count;
+
+  // One bit per line, set when the line has bytes outside of ASCII
+  size_t non_ascii_capacity;
+  uint64_t* non_ascii;
+} Lf_Index;
+
+void lf_index_scan(Lf_Index* index, const char* data, size_t start,
+                   size_t size);
+void lf_index_scan_parallel(Lf_Index* index, const char* data, size_t start,
+                            size_t size);
+size_t lf_index_threads(size_t size);
+size_t lf_index_parallel_size(void);
+void lf_index_append(Lf_Index* index, const Lf_Index* part);
+void lf_index_shrink(Lf_Index* index);
+void lf_index_free(Lf_Index* index);
+
+size_t lf_index_lower_bound(const Lf_Index* index, size_t offset);
+Lf_Style lf_index_style(const Lf_Index* index);
+bool lf_index_line_is_ascii(const Lf_Index* index, size_t line);
+size_t lf_index_non_ascii_lines(const Lf_Index* index);
+size_t lf_index_bytes(const Lf_Index* index);
+
+const char* lf_index_impl_name(void);
+const char* lf_style_name(Lf_Style style);
+
+#endif  // LF_INDEX_H_
@@ -0,0 +1,257 @@
+#include "./loader.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Waits until the inflater has a block's worth of text past offset, or
+// is done. Returns the end of the text there is so far.
+static size_t loader_wait_text(Loader* loader, size_t offset,
+                               size_t block_size)
+{
+  pthread_mutex_lock(&loader->mutex);
+  while (!loader->inflated && !loader->cancel &&
+         loader->produced - offset < block_size) {
+    pthread_cond_wait(&loader->cond, &loader->mutex);
+  }
+  const size_t end = loader->cancel ? offset : loader->produced;
+  pthread_mutex_unlock(&loader->mutex);
+  return end;
+}
+
+static void* loader_run(void* arg)
+{
+  Loader* loader = arg;
+  size_t block_size = LOADER_FIRST_BLOCK;
+  size_t offset = 0;
+
+  // Blocks start small so the first screen shows up right away, and
+  // grow until each one keeps every index worker busy. The next block is
+  // scanned while the editor splices in the ones before.
+  size_t max_block = lf_index_parallel_size();
+  if (max_block < LOADER_MAX_BLOCK) {
+    max_block = LOADER_MAX_BLOCK;
+  }
+  while (true) {
+    const size_t end = loader->inflating
+                           ? loader_wait_text(loader, offset, block_size)
+                           : loader->size;
+    if (offset >= end) {
+      break;
+    }
+    size_t n = end - offset;
+    if (n > block_size) {
+      n = block_size;
+    }
+
+    Loader_Block block = {.size = n};
+    lf_index_scan_parallel(&block.index, loader->data, offset, n);
+    offset += n;
+
+    pthread_mutex_lock(&loader->mutex);
+    const bool cancel = loader->cancel;
+    if (!cancel) {
+      if (loader->blocks_size >= loader->blocks_capacity) {
+        loader->blocks_capacity =
+            loader->blocks_capacity == 0 ? 16 : loader->blocks_capacity * 2;
+        loader->blocks =
+            realloc(loader->blocks,
+                    loader->blocks_capacity * sizeof(loader->blocks[0]));
+      }
+      loader->blocks[loader->blocks_size++] = block;
+      loader->indexed = offset;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+
+    if (cancel) {
+      lf_index_free(&block.index);
+      break;
+    }
+
+    if (block_size < max_block) {
+      block_size = block_size * 2 < max_block ? block_size * 2 : max_block;
+    }
+  }
+
+  pthread_mutex_lock(&loader->mutex);
+  loader->done = true;
+  pthread_mutex_unlock(&loader->mutex);
+  return NULL;
+}
+
+static bool loader_report(void* data, size_t produced, size_t consumed)
+{
+  Loader* loader = data;
+  pthread_mutex_lock(&loader->mutex);
+  loader->produced = produced;
+  loader->consumed = consumed;
+  const bool cancel = loader->cancel;
+  pthread_cond_signal(&loader->cond);
+  pthread_mutex_unlock(&loader->mutex);
+  return !cancel;
+}
+
+static void* loader_inflate(void* arg)
+{
+  Loader* loader = arg;
+  size_t produced = 0;
+  const bool ok =
+      compress_inflate(loader->fd, loader->format, (char*)loader->data,
+                       loader->capacity, loader_report, loader, &produced);
+  const int error = ok ? 0 : errno;
+
+  pthread_mutex_lock(&loader->mutex);
+  loader->produced = produced;
+  loader->consumed = loader->compressed_size;
+  loader->inflated = true;
+  loader->error = error;
+  pthread_cond_signal(&loader->cond);
+  pthread_mutex_unlock(&loader->mutex);
+  return NULL;
+}
+
+bool loader_start(Loader* loader, const char* data, size_t size)
+{
+  memset(loader, 0, sizeof(*loader));
+  loader->data = data;
+  loader->size = size;
+
+  if (pthread_mutex_init(&loader->mutex, NULL) != 0) {
+    return false;
+  }
+  if (pthread_create(&loader->thread, NULL, loader_run, loader) != 0) {
+    pthread_mutex_destroy(&loader->mutex);
+    return false;
+  }
+  loader->running = true;
+  return true;
+}
+
+// Decompresses the file open as fd into data, which has room for
+// capacity bytes, and indexes the text as it comes. fd is closed when the
+// loader stops. Once it is done, size is the size of the text and error
+// the errno of a failed decompression.
+bool loader_start_inflating(Loader* loader, int fd, Compress_Format format,
+                            char* data, size_t capacity)
+{
+  memset(loader, 0, sizeof(*loader));
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    return false;
+  }
+  loader->data = data;
+  loader->inflating = true;
+  loader->fd = fd;
+  loader->format = format;
+  loader->capacity = capacity;
+  loader->compressed_size = (size_t)st.st_size;
+
+  if (pthread_mutex_init(&loader->mutex, NULL) != 0) {
+    return false;
+  }
+  if (pthread_cond_init(&loader->cond, NULL) != 0) {
+    pthread_mutex_destroy(&loader->mutex);
+    return false;
+  }
+  if (pthread_create(&loader->inflater, NULL, loader_inflate, loader) !=
+      0) {
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->mutex);
+    return false;
+  }
+  if (pthread_create(&loader->thread, NULL, loader_run, loader) != 0) {
+    pthread_mutex_lock(&loader->mutex);
+    loader->cancel = true;
+    pthread_mutex_unlock(&loader->mutex);
+    pthread_join(loader->inflater, NULL);
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->mutex);
+    return false;
+  }
+  loader->running = true;
+  return true;
+}
+
+// Splices every block indexed so far into pt. Returns true while the
+// loader still has work left.
+bool loader_poll(Loader* loader, Piece_Table* pt)
+{
+  if (!loader->running) {
+    return false;
+  }
+
+  pthread_mutex_lock(&loader->mutex);
+  Loader_Block* blocks = loader->blocks;
+  const size_t blocks_size = loader->blocks_size;
+  const bool done = loader->done;
+  loader->blocks = NULL;
+  loader->blocks_size = 0;
+  loader->blocks_capacity = 0;
+  if (loader->inflating) {
+    loader->consumed_seen = loader->consumed;
+    loader->size = loader->produced;
+  }
+  pthread_mutex_unlock(&loader->mutex);
+
+  for (size_t i = 0; i < blocks_size; ++i) {
+    pt_extend_original(pt, blocks[i].size, &blocks[i].index);
+    loader->taken += blocks[i].size;
+    lf_index_free(&blocks[i].index);
+  }
+  free(blocks);
+
+  if (done) {
+    loader_stop(loader);
+    lf_index_shrink(&pt->buffers[0].index);
+    return false;
+  }
+  return true;
+}
+
+void loader_stop(Loader* loader)
+{
+  if (!loader->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&loader->mutex);
+  loader->cancel = true;
+  if (loader->inflating) {
+    pthread_cond_broadcast(&loader->cond);
+  }
+  pthread_mutex_unlock(&loader->mutex);
+
+  pthread_join(loader->thread, NULL);
+  if (loader->inflating) {
+    pthread_join(loader->inflater, NULL);
+    pthread_cond_destroy(&loader->cond);
+    close(loader->fd);
+    loader->size = loader->produced;
+  }
+  pthread_mutex_destroy(&loader->mutex);
+
+  for (size_t i = 0; i < loader->blocks_size; ++i) {
+    lf_index_free(&loader->blocks[i].index);
+  }
+  free(loader->blocks);
+  loader->blocks = NULL;
+  loader->blocks_size = 0;
+  loader->blocks_capacity = 0;
+  loader->running = false;
+}
+
+float loader_progress(const Loader* loader)
+{
+  if (loader->inflating) {
+    return loader->compressed_size > 0
+               ? (float)loader->consumed_seen /
+                     (float)loader->compressed_size
+               : 1.0f;
+  }
+  if (loader->size == 0) {
+    return 1.0f;
+  }
+  return (float)loader->taken / (float)loader->size;
+}
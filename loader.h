@@ -0,0 +1,64 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "compress.h"
+#include "lf_index.h"
+#include "piece_table.h"
+
+#define LOADER_FIRST_BLOCK (256 * 1024)
+// Blocks grow to this, or to lf_index_parallel_size() if that is more
+#define LOADER_MAX_BLOCK (64 * 1024 * 1024)
+
+typedef struct {
+  size_t size;
+  Lf_Index index;
+} Loader_Block;
+
+// Indexes a mapped file on a background thread. Finished blocks are
+// queued in file order and spliced into the piece table by the thread
+// that owns it, through loader_poll().
+//
+// A compressed file is decompressed by a second thread into memory that
+// was reserved for it, and indexed while that thread goes on, so the two
+// overlap. size then grows as the text comes in.
+typedef struct {
+  const char* data;
+  size_t size;
+  pthread_t thread;
+  bool running;
+
+  bool inflating;
+  int fd;
+  Compress_Format format;
+  size_t capacity;
+  size_t compressed_size;
+  pthread_t inflater;
+  pthread_cond_t cond;
+  size_t produced;
+  size_t consumed;
+  bool inflated;
+  int error;
+  size_t consumed_seen;
+
+  pthread_mutex_t mutex;
+  size_t blocks_capacity;
+  size_t blocks_size;
+  Loader_Block* blocks;
+  size_t indexed;
+  bool done;
+  bool cancel;
+
+  size_t taken;
+} Loader;
+
+bool loader_start(Loader* loader, const char* data, size_t size);
+bool loader_start_inflating(Loader* loader, int fd, Compress_Format format,
+                            char* data, size_t capacity);
+bool loader_poll(Loader* loader, Piece_Table* pt);
+void loader_stop(Loader* loader);
+float loader_progress(const Loader* loader);
+
+#endif  // LOADER_H_
@@ -1,7 +1,12 @@
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "gl_extra.h"
@@ -11,30 +16,325 @@
 #include "sdl_extra.h"
 #include "free_font.h"
 #include "cursor.h"
+#include "viewer.h"
 
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
 #define FPS 60
 #define DELTA_TIME (1.0f / FPS)
+#define RENDER_MARGIN 2
 
 Editor editor = {0};
+Viewer viewer = {0};
+bool viewing = false;
+// Number typed in the viewer before g (line) or % (percentage)
+char view_input[32] = "";
 Vec2f camera_pos = {0};
 Vec2f camera_vel = {0};
 Free_Render fr;
 
+typedef struct {
+  size_t begin;
+  size_t end;
+} Highlight;
+
+// Selections of all the cursors in text order, and the first one the
+// renderer has not gone past yet
+Highlight* highlights = NULL;
+size_t highlights_capacity = 0;
+size_t highlights_size = 0;
+size_t highlights_next = 0;
+
+// Outcome of the last save, shown in the title until the next one
+char status[128] = "";
+
+static void report_save(const Save_Result* result, const char* file_path)
+{
+  save_print_result(result, file_path,
+                    result->failed != NULL ? stderr : stdout);
+  if (result->failed != NULL) {
+    snprintf(status, sizeof(status), "save failed: %s",
+             strerror(result->error));
+  } else {
+    status[0] = '\0';
+  }
+}
+
+// Shows what the editor is busy with in the title of the window
+static void update_title(SDL_Window* window, const char* file_path,
+                         bool loading)
+{
+  static char shown[512] = "";
+  char title[512];
+  int n = snprintf(title, sizeof(title), "jed - %s", file_path);
+  if (editor_streaming(&editor) && n >= 0 && (size_t)n < sizeof(title)) {
+    n += snprintf(title + n, sizeof(title) - n, " (reading)");
+  }
+  if (loading && n >= 0 && (size_t)n < sizeof(title)) {
+    n += snprintf(title + n, sizeof(title) - n, " (loading %d%%)",
+                  (int)(editor_load_progress(&editor) * 100.0f));
+  }
+  if (editor_saving(&editor) && n >= 0 && (size_t)n < sizeof(title)) {
+    n += snprintf(title + n, sizeof(title) - n, " (saving %d%%)",
+                  (int)(editor_save_progress(&editor) * 100.0f));
+  }
+  if (viewing && n >= 0 && (size_t)n < sizeof(title)) {
+    size_t row = 0;
+    size_t rows = 0;
+    const bool counted = viewer_rows(&viewer, &rows);
+    if (viewer_top_row(&viewer, &row)) {
+      n += snprintf(title + n, sizeof(title) - n, " (line %zu of %zu%s)",
+                    row + 1, rows, counted ? "" : "+");
+    }
+    if (!counted && n >= 0 && (size_t)n < sizeof(title)) {
+      n += snprintf(title + n, sizeof(title) - n, " (indexing %d%%)",
+                    (int)(viewer_progress(&viewer) * 100.0f));
+    }
+    if (view_input[0] != '\0' && n >= 0 && (size_t)n < sizeof(title)) {
+      n += snprintf(title + n, sizeof(title) - n, " (go to %s)",
+                    view_input);
+    }
+  }
+  if (editor.load_error != 0 && n >= 0 && (size_t)n < sizeof(title)) {
+    n += snprintf(title + n, sizeof(title) - n, " (partly loaded: %s)",
+                  strerror(editor.load_error));
+  }
+  if (status[0] != '\0' && n >= 0 && (size_t)n < sizeof(title)) {
+    snprintf(title + n, sizeof(title) - n, " (%s)", status);
+  }
+
+  if (strcmp(title, shown) != 0) {
+    strcpy(shown, title);
+    SDL_SetWindowTitle(window, title);
+  }
+}
+
+// Keys of the read-only viewer. A number typed before g goes to that
+// line, before % to that part of the file; G goes to the end.
+static void view_key(SDL_Keycode key, size_t page)
+{
+  switch (key) {
+  case SDLK_UP: {
+    viewer_scroll(&viewer, -1);
+  } break;
+  case SDLK_DOWN: {
+    viewer_scroll(&viewer, 1);
+  } break;
+  case SDLK_PAGEUP: {
+    viewer_scroll(&viewer, -(long)page);
+  } break;
+  case SDLK_PAGEDOWN: {
+    viewer_scroll(&viewer, (long)page);
+  } break;
+  case SDLK_HOME: {
+    viewer_goto_line(&viewer, 0);
+  } break;
+  case SDLK_END: {
+    viewer_goto_end(&viewer);
+    viewer_scroll(&viewer, -(long)page + 1);
+  } break;
+  case SDLK_BACKSPACE: {
+    const size_t n = strlen(view_input);
+    if (n > 0) {
+      view_input[n - 1] = '\0';
+    }
+  } break;
+  }
+}
+
+static void view_text(const char* text)
+{
+  for (; *text != '\0'; ++text) {
+    const size_t n = strlen(view_input);
+    if ((isdigit((unsigned char)*text) || *text == '.') &&
+        n + 1 < sizeof(view_input)) {
+      view_input[n] = *text;
+      view_input[n + 1] = '\0';
+    } else if (*text == 'g' && n > 0) {
+      const size_t row = strtoull(view_input, NULL, 10);
+      viewer_goto_line(&viewer, row > 0 ? row - 1 : 0);
+      view_input[0] = '\0';
+    } else if (*text == '%' && n > 0) {
+      viewer_goto_percent(&viewer, strtod(view_input, NULL));
+      view_input[0] = '\0';
+    } else if (*text == 'G') {
+      viewer_goto_end(&viewer);
+      view_input[0] = '\0';
+    }
+  }
+}
+
+// Arrow keys extend the selection while shift is held and drop it
+// otherwise. Extra cursors only last until the main one moves.
+static void begin_cursor_motion(Uint16 mod)
+{
+  undo_seal(&editor.undo);
+  editor_clear_cursors(&editor);
+  if (mod & KMOD_SHIFT) {
+    editor_start_selection(&editor);
+  } else {
+    editor_clear_selection(&editor);
+  }
+}
+
+static void push_highlight(size_t begin, size_t end)
+{
+  if (highlights_size >= highlights_capacity) {
+    highlights_capacity =
+        highlights_capacity == 0 ? 16 : highlights_capacity * 2;
+    highlights =
+        realloc(highlights, highlights_capacity * sizeof(highlights[0]));
+  }
+  highlights[highlights_size++] = (Highlight){begin, end};
+}
+
+static int compare_highlights(const void* a, const void* b)
+{
+  const Highlight* x = a;
+  const Highlight* y = b;
+  return x->begin < y->begin ? -1 : x->begin > y->begin;
+}
+
+// Extra cursors without a selection are shown as one highlighted cell
+static void collect_highlights(void)
+{
+  highlights_size = 0;
+  highlights_next = 0;
+
+  size_t begin = 0;
+  size_t end = 0;
+  if (editor_selection(&editor, &begin, &end)) {
+    push_highlight(begin, end);
+  }
+  for (size_t i = 0; i < editor.cursors_size; ++i) {
+    const Editor_Cursor* cursor = &editor.cursors[i];
+    begin = cursor->anchor < cursor->offset ? cursor->anchor
+                                            : cursor->offset;
+    end = cursor->anchor < cursor->offset ? cursor->offset
+                                          : cursor->anchor;
+    push_highlight(begin, begin < end ? end : begin + 1);
+  }
+  qsort(highlights, highlights_size, sizeof(highlights[0]),
+        compare_highlights);
+}
+
+// Row or column at a distance of at cells from the start of the text
+static size_t visible_cell(float at)
+{
+  return at > 0.0f ? (size_t)at : 0;
+}
+
+// Renders line, which starts at offset in the text, with the parts of it
+// under a highlight drawn on a colored background
+static void render_line(String_View line, size_t offset, Vec2f pos)
+{
+  while (line.count > 0) {
+    while (highlights_next < highlights_size &&
+           highlights[highlights_next].end <= offset) {
+      highlights_next += 1;
+    }
+
+    const Highlight* h = highlights_next < highlights_size
+                             ? &highlights[highlights_next]
+                             : NULL;
+    const bool selected = h != NULL && h->begin <= offset;
+    size_t n = line.count;
+    if (selected && h->end - offset < n) {
+      n = h->end - offset;
+    } else if (!selected && h != NULL && h->begin - offset < n) {
+      n = h->begin - offset;
+    }
+
+    fr_render_text_sized(&fr, line.data, n, pos, vec4fs(1.0f),
+                         selected ? vec4f(0.3f, 0.3f, 0.6f, 1.0f)
+                                  : vec4fs(0.0f));
+    pos.x += n * fr.glyph_info.cw;
+    offset += n;
+    sv_chop_left(&line, n);
+  }
+}
+
 int main(int argc, char** argv)
 {
   const char* file_path = NULL;
-
-  if (argc > 1) {
+  bool follow = false;
+
+  // jed -f FILE keeps reading what gets appended to FILE, jed -r FILE
+  // only views it and jed - reads stdin
+  const bool from_stdin = argc > 1 && strcmp(argv[1], "-") == 0;
+  bool streaming = from_stdin;
+  if (argc > 2 && (strcmp(argv[1], "-f") == 0 ||
+                   strcmp(argv[1], "--follow") == 0)) {
+    follow = true;
+    file_path = argv[2];
+  } else if (argc > 2 && (strcmp(argv[1], "-r") == 0 ||
+                          strcmp(argv[1], "--view") == 0)) {
+    viewing = true;
+    file_path = argv[2];
+  } else if (argc > 1 && !from_stdin) {
     file_path = argv[1];
   }
 
-  if (file_path) {
+  // The editor keeps a line table of the whole file, which would not
+  // fit for a file larger than memory
+  struct stat st;
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (file_path != NULL && !follow && pages > 0 && page_size > 0 &&
+      stat(file_path, &st) == 0 && S_ISREG(st.st_mode) &&
+      (size_t)st.st_size > (size_t)pages * (size_t)page_size) {
+    printf("`%s` is larger than memory, opening it read-only\n",
+           file_path);
+    viewing = true;
+  }
+  if (viewing && !viewer_open(&viewer, file_path)) {
+    fprintf(stderr, "ERROR: could not open `%s`: %s\n", file_path,
+            strerror(errno));
+    exit(1);
+  }
+
+  // Bytes of history kept for undo
+  const char* undo_budget = getenv("JED_UNDO_BUDGET");
+  if (undo_budget != NULL) {
+    undo_set_budget(&editor.undo, strtoull(undo_budget, NULL, 10));
+  }
+
+  bool loading = false;
+  if (streaming && !editor_start_streaming(&editor, STDIN_FILENO)) {
+    fprintf(stderr, "ERROR: could not start reading stdin\n");
+    exit(1);
+  }
+  if (file_path && !viewing) {
     FILE* file = fopen(file_path, "r");
     if (file != NULL) {
-      editor_load_from_file(&editor, file);
+      if (follow) {
+        // Logs get truncated in place, which would pull the pages of a
+        // mapping out from under the text, so the log is read
+        editor_read_from_file(&editor, file);
+        editor_start_following(&editor, file_path, file);
+      } else {
+        editor_start_loading(&editor, file_path, file);
+      }
       fclose(file);
+      loading = true;
+      if (!follow) {
+        editor_start_watching(&editor, file_path);
+      }
+    } else if (compress_supported(compress_format_of_path(file_path))) {
+      // Existing files keep the format they were loaded in, only a new
+      // one goes by its name
+      editor.compressed = compress_format_of_path(file_path);
+    }
+
+    // A followed file changes all the time, so there is nothing for the
+    // journal to replay its edits on
+    const size_t recovered =
+        follow ? 0 : editor_open_journal(&editor, file_path);
+    if (recovered > 0) {
+      printf("Recovered %zu unsaved edits of `%s` from its journal\n",
+             recovered, file_path);
+      snprintf(status, sizeof(status), "recovered %zu unsaved edits",
+               recovered);
     }
   }
 
@@ -98,14 +398,29 @@ int main(int argc, char** argv)
       } break;
 
       case SDL_KEYDOWN: {
+        if (viewing) {
+          view_key(event.key.keysym.sym,
+                   (size_t)(window_size(window).y /
+                            (fr.glyph_info.ch * FONT_SCALE)));
+          break;
+        }
         switch (event.key.keysym.sym) {
         case SDLK_BACKSPACE: {
           editor_backspace(&editor);
         } break;
 
         case SDLK_F2: {
-          if (file_path) {
-            editor_save_to_file(&editor, file_path);
+          if (file_path == NULL) {
+            break;
+          }
+          // Saving before the whole file is loaded, or after only part
+          // of it could be, would cut it short
+          if (loading) {
+            snprintf(status, sizeof(status), "wait for loading to save");
+          } else if (editor.load_error != 0) {
+            snprintf(status, sizeof(status), "not saving a partial text");
+          } else if (editor_start_saving(&editor, file_path)) {
+            status[0] = '\0';
           }
         } break;
 
@@ -117,30 +432,85 @@ int main(int argc, char** argv)
           editor_delete(&editor);
         } break;
 
+        case SDLK_c:
+        case SDLK_x: {
+          if (!(event.key.keysym.mod & KMOD_CTRL)) {
+            break;
+          }
+          char* text = editor_copy_selections(&editor);
+          if (text != NULL) {
+            SDL_SetClipboardText(text);
+            free(text);
+            if (event.key.keysym.sym == SDLK_x) {
+              editor_cut_selections(&editor);
+            }
+          }
+        } break;
+
+        case SDLK_d: {
+          if (event.key.keysym.mod & KMOD_CTRL) {
+            editor_select_occurrences(&editor);
+          }
+        } break;
+
+        case SDLK_v: {
+          if (event.key.keysym.mod & KMOD_CTRL) {
+            char* text = SDL_GetClipboardText();
+            if (text != NULL) {
+              editor_insert_text(&editor, text, strlen(text));
+              SDL_free(text);
+            }
+          }
+        } break;
+
+        case SDLK_z: {
+          if (event.key.keysym.mod & KMOD_CTRL) {
+            if (event.key.keysym.mod & KMOD_SHIFT) {
+              editor_redo(&editor);
+            } else {
+              editor_undo(&editor);
+            }
+          }
+        } break;
+
+        case SDLK_y: {
+          if (event.key.keysym.mod & KMOD_CTRL) {
+            editor_redo(&editor);
+          }
+        } break;
+
         case SDLK_UP: {
+          begin_cursor_motion(event.key.keysym.mod);
           if (editor.cursor_row > 0) {
             editor.cursor_row -= 1;
           }
         } break;
 
         case SDLK_DOWN: {
+          begin_cursor_motion(event.key.keysym.mod);
           editor.cursor_row += 1;
         } break;
 
         case SDLK_LEFT: {
+          begin_cursor_motion(event.key.keysym.mod);
           if (editor.cursor_col > 0) {
             editor.cursor_col -= 1;
           }
         } break;
 
         case SDLK_RIGHT: {
+          begin_cursor_motion(event.key.keysym.mod);
           editor.cursor_col += 1;
         } break;
         }
       } break;
 
       case SDL_TEXTINPUT: {
-        editor_insert_text_before_cursor(&editor, event.text.text);
+        if (viewing) {
+          view_text(event.text.text);
+        } else {
+          editor_insert_text_before_cursor(&editor, event.text.text);
+        }
       } break;
 
       case SDL_MOUSEBUTTONDOWN: {
@@ -156,6 +526,12 @@ int main(int argc, char** argv)
                         camera_pos);
           if (cursor_click.x >= 0.0f &&
               cursor_click.y <= fr.glyph_info.ch * FONT_SCALE) {
+            // Ctrl+click leaves a cursor behind where the main one was
+            if (SDL_GetModState() & KMOD_CTRL) {
+              editor_duplicate_cursor(&editor);
+            } else {
+              begin_cursor_motion(0);
+            }
             editor.cursor_col = (size_t)floorf(
                 cursor_click.x / (fr.glyph_info.cw * FONT_SCALE));
             editor.cursor_row = (size_t)floorf(
@@ -184,7 +560,65 @@ int main(int argc, char** argv)
       }
     }
 
+    editor_poll_mapping(&editor);
+    if (loading) {
+      loading = editor_poll_loading(&editor);
+      if (!loading) {
+        // JED_LOAD_REPORT=1 prints how the file was loaded and how long
+        // it took
+        if (getenv("JED_LOAD_REPORT") != NULL) {
+          editor_print_load_report(&editor, stdout);
+        }
+        if (follow) {
+          editor.cursor_row = editor_rows(&editor);
+        }
+      }
+    }
+
     {
+      Save_Result result;
+      if (editor_poll_saving(&editor, &result)) {
+        report_save(&result, file_path);
+      }
+    }
+
+    editor_poll_journal(&editor);
+    switch (editor_poll_watching(&editor)) {
+    case WATCH_RELOAD:
+      snprintf(status, sizeof(status), "reloaded, changed on disk");
+      break;
+    case WATCH_CHANGED:
+      snprintf(status, sizeof(status), "changed on disk");
+      break;
+    case WATCH_NONE:
+      break;
+    }
+    switch (editor_poll_following(&editor)) {
+    case FOLLOW_TRUNCATED:
+      snprintf(status, sizeof(status), "following, file truncated");
+      break;
+    case FOLLOW_ROTATED:
+      snprintf(status, sizeof(status), "following, file replaced");
+      break;
+    case FOLLOW_APPENDED:
+    case FOLLOW_NONE:
+      break;
+    }
+    if (streaming) {
+      streaming = editor_poll_streaming(&editor);
+    }
+    if (file_path) {
+      update_title(window, file_path, loading);
+    } else if (from_stdin) {
+      update_title(window, "stdin", false);
+    }
+
+    if (viewing) {
+      // The top line of the viewer is always row 0, so the camera stays
+      // put whatever the line number
+      const Vec2f ws = window_size(window);
+      camera_pos = vec2f(ws.x / 2.0f, -ws.y / 2.0f + fr.glyph_info.ch);
+    } else {
       const Vec2f cursor_pos = vec2f(
           (float)editor.cursor_col * fr.glyph_info.cw,
           (float)(-(int)editor.cursor_row) * fr.glyph_info.ch);
@@ -195,12 +629,48 @@ int main(int argc, char** argv)
     }
 
     fr_glyph_buffer_clear(&fr);
-    {
-      for (size_t row = 0; row < editor.size; ++row) {
-        const Line* line = editor.lines + row;
-        fr_render_text_sized(&fr, line->chars, line->size, vec2f(0, -(int)row*fr.glyph_info.th),
+    if (viewing) {
+      const size_t rows = (size_t)(window_size(window).y /
+                                   (fr.glyph_info.ch * FONT_SCALE)) +
+                          1;
+      const String_View* lines = NULL;
+      const size_t count = viewer_lines(&viewer, rows, &lines);
+      for (size_t row = 0; row < count; ++row) {
+        fr_render_text_sized(&fr, lines[row].data, lines[row].count,
+                             vec2f(0.0f, -(int)row * fr.glyph_info.th),
                              vec4fs(1.0f), vec4fs(0.0f));
       }
+    } else {
+      collect_highlights();
+
+      // Only the cells under the camera are rendered, so a frame costs
+      // the same whatever the size of the file or of its lines. The
+      // margin has the glyphs scrolling in already there.
+      const Vec2f ws = window_size(window);
+      const float row_height = fr.glyph_info.th * FONT_SCALE;
+      const float col_width = fr.glyph_info.cw * FONT_SCALE;
+      const size_t first_row = visible_cell(
+          -(camera_pos.y + ws.y / 2.0f) / row_height - RENDER_MARGIN);
+      const size_t last_row = visible_cell(
+          -(camera_pos.y - ws.y / 2.0f) / row_height + RENDER_MARGIN + 1);
+      const size_t first_col = visible_cell(
+          (camera_pos.x - ws.x / 2.0f) / col_width - RENDER_MARGIN);
+      const size_t last_col = visible_cell(
+          (camera_pos.x + ws.x / 2.0f) / col_width + RENDER_MARGIN + 1);
+
+      const size_t rows = editor_rows(&editor);
+      for (size_t row = first_row; row < last_row && row < rows; ++row) {
+        const size_t start = editor_line_start(&editor, row);
+        Pt_Iter it = editor_line_iter(&editor, row, first_col, last_col);
+        String_View chunk = {0};
+        size_t col = first_col;
+        while (pt_iter_next(&it, &chunk)) {
+          render_line(chunk, start + col,
+                      vec2f(col * fr.glyph_info.cw,
+                            -(int)row * fr.glyph_info.th));
+          col += chunk.count;
+        }
+      }
     }
     fr_glyph_buffer_sync(&fr);
 
@@ -225,5 +695,16 @@ int main(int argc, char** argv)
       SDL_Delay(delta_time_ms - duration);
     }
   }
+
+  Save_Result result;
+  if (editor_finish_saving(&editor, &result)) {
+    report_save(&result, file_path);
+  }
+  editor_stop_watching(&editor);
+  editor_stop_following(&editor);
+  editor_close_journal(&editor);
+  viewer_close(&viewer);
+  editor_stop_streaming(&editor);
+  editor_close_cache(&editor);
   return 0;
 }
@@ -0,0 +1,840 @@
+#include "./piece_table.h"
+
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define PT_INIT_CAPACITY 16
+#define PT_DIRECTORY_INIT_CAPACITY 16
+// Nodes are split once they exceed PT_NODE_SPLIT entries, which leaves
+// room for the two extra pieces a single splice may add to a leaf.
+#define PT_NODE_SPLIT (PT_NODE_MAX - 2)
+#define PT_NODE_MIN (PT_NODE_SPLIT / 4)
+
+static void buffers_grow(Piece_Table* pt, size_t n)
+{
+  size_t new_capacity = pt->buffers_capacity;
+
+  assert(new_capacity >= pt->buffers_size);
+  while (new_capacity - pt->buffers_size < n) {
+    if (new_capacity == 0) {
+      new_capacity = PT_INIT_CAPACITY;
+    } else {
+      new_capacity *= 2;
+    }
+  }
+
+  if (new_capacity != pt->buffers_capacity) {
+    pt->buffers =
+        realloc(pt->buffers, new_capacity * sizeof(pt->buffers[0]));
+    pt->buffers_capacity = new_capacity;
+  }
+}
+
+Piece pt_piece(const Piece_Table* pt, size_t buffer, size_t start,
+               size_t size)
+{
+  const Pt_Buffer* b = &pt->buffers[buffer];
+  return (Piece){
+      .buffer = buffer,
+      .start = start,
+      .size = size,
+      .lf_count = lf_index_lower_bound(&b->index, start + size) -
+                  lf_index_lower_bound(&b->index, start),
+  };
+}
+
+// Appends next to piece when next continues it within the same buffer,
+// which is what consecutive inserts at one spot produce.
+static bool piece_try_extend(Piece* piece, Piece next)
+{
+  if (piece->buffer != next.buffer ||
+      piece->start + piece->size != next.start) {
+    return false;
+  }
+  piece->size += next.size;
+  piece->lf_count += next.lf_count;
+  return true;
+}
+
+static void pt_directory_release(Pt_Directory* directory)
+{
+  if (directory != NULL && --directory->refs == 0) {
+    free(directory);
+  }
+}
+
+// Records where the data of a new buffer lives. The directory is shared
+// with snapshots, so instead of growing it in place it is replaced by a
+// bigger copy once full; entries it already has never change.
+static void pt_directory_push(Piece_Table* pt, char* data)
+{
+  Pt_Directory* directory = pt->directory;
+  if (directory == NULL || directory->size == directory->capacity) {
+    const size_t capacity = directory == NULL
+                                ? PT_DIRECTORY_INIT_CAPACITY
+                                : directory->capacity * 2;
+    Pt_Directory* grown =
+        malloc(sizeof(Pt_Directory) + capacity * sizeof(grown->data[0]));
+    grown->refs = 1;
+    grown->capacity = capacity;
+    grown->size = 0;
+    if (directory != NULL) {
+      memcpy(grown->data, directory->data,
+             directory->size * sizeof(directory->data[0]));
+      grown->size = directory->size;
+      pt_directory_release(directory);
+    }
+    pt->directory = directory = grown;
+  }
+  directory->data[directory->size++] = data;
+}
+
+// Stores text in an add buffer without putting it in the text yet. The
+// returned piece can then be inserted any number of times.
+Piece pt_append_add(Piece_Table* pt, const char* text, size_t text_size)
+{
+  Pt_Buffer* buffer = NULL;
+  if (pt->buffers_size > 0) {
+    buffer = &pt->buffers[pt->buffers_size - 1];
+    if (buffer->capacity == 0 ||
+        buffer->capacity - buffer->size < text_size) {
+      buffer = NULL;
+    }
+  }
+
+  if (buffer == NULL) {
+    buffers_grow(pt, 1);
+    buffer = &pt->buffers[pt->buffers_size++];
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->capacity = text_size > PT_ADD_BUFFER_CAPACITY
+                           ? text_size
+                           : PT_ADD_BUFFER_CAPACITY;
+    buffer->data = malloc(buffer->capacity);
+    buffer->owned = true;
+    pt_directory_push(pt, buffer->data);
+  }
+
+  size_t start = buffer->size;
+  memcpy(buffer->data + start, text, text_size);
+  buffer->size += text_size;
+  lf_index_scan_parallel(&buffer->index, buffer->data, start, text_size);
+
+  return pt_piece(pt, (size_t)(buffer - pt->buffers), start, text_size);
+}
+
+static Pt_Node* node_new(Piece_Table* pt, bool leaf)
+{
+  pt->nodes.object_size = sizeof(Pt_Node);
+  Pt_Node* node = pool_alloc(&pt->nodes);
+  node->leaf = leaf;
+  node->refs = 1;
+  return node;
+}
+
+static void node_unref(Piece_Table* pt, Pt_Node* node)
+{
+  if (node == NULL || --node->refs > 0) {
+    return;
+  }
+  if (!node->leaf) {
+    for (size_t i = 0; i < node->count; ++i) {
+      node_unref(pt, node->children[i]);
+    }
+  }
+  pool_release(&pt->nodes, node);
+}
+
+// Makes *slot safe to modify. A node still referenced by a snapshot is
+// copied and the copy takes its place in the tree, so every edit copies
+// at most the path from the root down to the pieces it touches.
+static Pt_Node* node_own(Piece_Table* pt, Pt_Node** slot)
+{
+  Pt_Node* node = *slot;
+  if (node->refs == 1) {
+    return node;
+  }
+
+  Pt_Node* copy = node_new(pt, node->leaf);
+  memcpy(copy, node, sizeof(*copy));
+  copy->refs = 1;
+  if (!copy->leaf) {
+    for (size_t i = 0; i < copy->count; ++i) {
+      copy->children[i]->refs += 1;
+    }
+  }
+  node->refs -= 1;
+  *slot = copy;
+  return copy;
+}
+
+static size_t node_entry_size(const Pt_Node* node)
+{
+  return node->leaf ? sizeof(node->pieces[0]) : sizeof(node->children[0]);
+}
+
+static char* node_entries(Pt_Node* node)
+{
+  return (char*)node->pieces;
+}
+
+static void node_update(Pt_Node* node)
+{
+  node->size = 0;
+  node->lf_count = 0;
+  for (size_t i = 0; i < node->count; ++i) {
+    if (node->leaf) {
+      node->size += node->pieces[i].size;
+      node->lf_count += node->pieces[i].lf_count;
+    } else {
+      node->size += node->children[i]->size;
+      node->lf_count += node->children[i]->lf_count;
+    }
+  }
+}
+
+static void node_insert_entries(Pt_Node* node, size_t index,
+                                const void* entries, size_t n)
+{
+  const size_t entry_size = node_entry_size(node);
+  char* base = node_entries(node);
+
+  assert(node->count + n <= PT_NODE_MAX);
+  memmove(base + (index + n) * entry_size, base + index * entry_size,
+          (node->count - index) * entry_size);
+  memcpy(base + index * entry_size, entries, n * entry_size);
+  node->count += n;
+}
+
+static void node_remove_entries(Pt_Node* node, size_t index, size_t n)
+{
+  const size_t entry_size = node_entry_size(node);
+  char* base = node_entries(node);
+
+  memmove(base + index * entry_size, base + (index + n) * entry_size,
+          (node->count - index - n) * entry_size);
+  node->count -= n;
+}
+
+static Pt_Node* node_split(Piece_Table* pt, Pt_Node* node)
+{
+  const size_t entry_size = node_entry_size(node);
+  const size_t half = node->count / 2;
+
+  Pt_Node* right = node_new(pt, node->leaf);
+  right->count = node->count - half;
+  memcpy(node_entries(right), node_entries(node) + half * entry_size,
+         right->count * entry_size);
+  node->count = half;
+
+  node_update(node);
+  node_update(right);
+  return right;
+}
+
+// Merges children[index] with children[index + 1] when they fit into one
+// node, otherwise spreads their entries evenly between the two.
+static void node_merge_children(Piece_Table* pt, Pt_Node* node,
+                                size_t index)
+{
+  Pt_Node* left = node_own(pt, &node->children[index]);
+  Pt_Node* right = node_own(pt, &node->children[index + 1]);
+  const size_t entry_size = node_entry_size(left);
+  const size_t total = left->count + right->count;
+
+  if (total <= PT_NODE_SPLIT) {
+    memcpy(node_entries(left) + left->count * entry_size,
+           node_entries(right), right->count * entry_size);
+    left->count = total;
+    right->count = 0;
+    node_update(left);
+    node_unref(pt, right);
+    node_remove_entries(node, index + 1, 1);
+    return;
+  }
+
+  const size_t half = total / 2;
+  if (left->count < half) {
+    const size_t n = half - left->count;
+    memcpy(node_entries(left) + left->count * entry_size,
+           node_entries(right), n * entry_size);
+    left->count += n;
+    node_remove_entries(right, 0, n);
+  } else if (left->count > half) {
+    const size_t n = left->count - half;
+    node_insert_entries(right, 0,
+                        node_entries(left) + half * entry_size, n);
+    left->count = half;
+  }
+  node_update(left);
+  node_update(right);
+}
+
+static void node_rebalance(Piece_Table* pt, Pt_Node* node)
+{
+  size_t i = 0;
+  while (i < node->count) {
+    if (node->children[i]->count == 0) {
+      node_unref(pt, node->children[i]);
+      node_remove_entries(node, i, 1);
+    } else {
+      i += 1;
+    }
+  }
+
+  i = 0;
+  while (i < node->count && node->count > 1) {
+    if (node->children[i]->count < PT_NODE_MIN) {
+      const size_t left = i + 1 < node->count ? i : i - 1;
+      node_merge_children(pt, node, left);
+      i = left;
+    } else {
+      i += 1;
+    }
+  }
+}
+
+// Inserts piece at offset within the subtree of node. Returns the new
+// right sibling when node had to be split.
+static Pt_Node* node_insert(Piece_Table* pt, Pt_Node* node,
+                            size_t offset, Piece piece)
+{
+  if (node->leaf) {
+    size_t i = 0;
+    while (i < node->count && offset >= node->pieces[i].size) {
+      offset -= node->pieces[i].size;
+      i += 1;
+    }
+
+    if (offset > 0) {
+      const Piece split = node->pieces[i];
+      const Piece parts[2] = {
+          piece,
+          pt_piece(pt, split.buffer, split.start + offset,
+                   split.size - offset),
+      };
+      node->pieces[i] = pt_piece(pt, split.buffer, split.start, offset);
+      node_insert_entries(node, i + 1, parts, 2);
+    } else if (i == 0 || !piece_try_extend(&node->pieces[i - 1], piece)) {
+      node_insert_entries(node, i, &piece, 1);
+    }
+  } else {
+    size_t i = 0;
+    while (i + 1 < node->count && offset > node->children[i]->size) {
+      offset -= node->children[i]->size;
+      i += 1;
+    }
+
+    Pt_Node* split =
+        node_insert(pt, node_own(pt, &node->children[i]), offset, piece);
+    if (split != NULL) {
+      node_insert_entries(node, i + 1, &split, 1);
+    }
+  }
+
+  node_update(node);
+  return node->count > PT_NODE_SPLIT ? node_split(pt, node) : NULL;
+}
+
+// Removes [offset, offset + count) from the subtree of node. Returns the
+// new right sibling when a piece split in the middle overflowed node.
+static Pt_Node* node_delete(Piece_Table* pt, Pt_Node* node,
+                            size_t offset, size_t count)
+{
+  const size_t end = offset + count;
+
+  if (node->leaf) {
+    Piece kept[PT_NODE_MAX];
+    size_t kept_count = 0;
+    size_t start = 0;
+
+    for (size_t i = 0; i < node->count; ++i) {
+      const Piece piece = node->pieces[i];
+      const size_t piece_end = start + piece.size;
+      if (piece_end <= offset || start >= end) {
+        kept[kept_count++] = piece;
+      } else {
+        if (start < offset) {
+          kept[kept_count++] =
+              pt_piece(pt, piece.buffer, piece.start, offset - start);
+        }
+        if (piece_end > end) {
+          kept[kept_count++] =
+              pt_piece(pt, piece.buffer, piece.start + (end - start),
+                       piece_end - end);
+        }
+      }
+      start = piece_end;
+    }
+
+    assert(kept_count <= PT_NODE_MAX);
+    memcpy(node->pieces, kept, kept_count * sizeof(kept[0]));
+    node->count = kept_count;
+  } else {
+    size_t start = 0;
+    for (size_t i = 0; i < node->count && start < end; ++i) {
+      const size_t child_size = node->children[i]->size;
+      const size_t child_end = start + child_size;
+
+      if (child_end > offset) {
+        Pt_Node* child = node_own(pt, &node->children[i]);
+        const size_t local_begin = offset > start ? offset - start : 0;
+        const size_t local_end = end < child_end ? end - start : child_size;
+        Pt_Node* split =
+            node_delete(pt, child, local_begin, local_end - local_begin);
+        if (split != NULL) {
+          node_insert_entries(node, i + 1, &split, 1);
+          i += 1;
+        }
+      }
+      start = child_end;
+    }
+
+    node_rebalance(pt, node);
+  }
+
+  node_update(node);
+  return node->count > PT_NODE_SPLIT ? node_split(pt, node) : NULL;
+}
+
+static void pt_grow_root(Piece_Table* pt, Pt_Node* split)
+{
+  if (split != NULL) {
+    Pt_Node* root = node_new(pt, false);
+    root->children[0] = pt->root;
+    root->children[1] = split;
+    root->count = 2;
+    node_update(root);
+    pt->root = root;
+  }
+
+  if (!pt->root->leaf && pt->root->count == 0) {
+    pool_release(&pt->nodes, pt->root);
+    pt->root = node_new(pt, true);
+  }
+
+  while (!pt->root->leaf && pt->root->count == 1) {
+    Pt_Node* root = pt->root;
+    pt->root = root->children[0];
+    pool_release(&pt->nodes, root);
+  }
+
+  pt->size = pt->root->size;
+  pt->lf_count = pt->root->lf_count;
+}
+
+void pt_insert_piece(Piece_Table* pt, size_t offset, Piece piece)
+{
+  if (piece.size == 0) {
+    return;
+  }
+  if (offset > pt->size) {
+    offset = pt->size;
+  }
+  if (pt->root == NULL) {
+    pt->root = node_new(pt, true);
+  }
+  pt_grow_root(pt, node_insert(pt, node_own(pt, &pt->root), offset, piece));
+}
+
+void pt_begin_original(Piece_Table* pt, char* data, bool owned)
+{
+  assert(pt->buffers_size == 0 &&
+         "You can only load the original buffer into an empty table");
+
+  buffers_grow(pt, 1);
+  Pt_Buffer* buffer = &pt->buffers[pt->buffers_size++];
+  memset(buffer, 0, sizeof(*buffer));
+  buffer->data = data;
+  buffer->owned = owned;
+  pt_directory_push(pt, data);
+}
+
+// Appends the next size bytes of the original buffer, already indexed
+// into index, to the end of the text
+void pt_extend_original(Piece_Table* pt, size_t size, const Lf_Index* index)
+{
+  assert(pt->buffers_size > 0 && pt->buffers[0].capacity == 0);
+
+  Pt_Buffer* buffer = &pt->buffers[0];
+  const size_t start = buffer->size;
+  lf_index_append(&buffer->index, index);
+  buffer->size += size;
+
+  if (size > 0) {
+    pt_insert_piece(pt, pt->size, pt_piece(pt, 0, start, size));
+  }
+}
+
+void pt_load_original(Piece_Table* pt, char* data, size_t size, bool owned)
+{
+  pt_begin_original(pt, data, owned);
+
+  Pt_Buffer* buffer = &pt->buffers[0];
+  lf_index_scan_parallel(&buffer->index, data, 0, size);
+  lf_index_shrink(&buffer->index);
+  buffer->size = size;
+
+  if (size > 0) {
+    pt_insert_piece(pt, 0, pt_piece(pt, 0, 0, size));
+  }
+}
+
+// The mapping is never written: edits go to add buffers, so pages of
+// unedited text stay shared with the page cache.
+void pt_load_mapping(Piece_Table* pt, char* mapping, size_t size)
+{
+  pt_load_original(pt, mapping, size, false);
+  pt->mapping = mapping;
+  pt->mapping_size = size;
+}
+
+// Same as pt_load_mapping() with the line index already known, e.g. from
+// a cache. The table takes over index.
+void pt_load_mapping_indexed(Piece_Table* pt, char* mapping, size_t size,
+                             Lf_Index* index)
+{
+  pt_begin_mapping(pt, mapping, size);
+
+  Pt_Buffer* buffer = &pt->buffers[0];
+  buffer->index = *index;
+  memset(index, 0, sizeof(*index));
+  buffer->size = size;
+
+  if (size > 0) {
+    pt_insert_piece(pt, 0, pt_piece(pt, 0, 0, size));
+  }
+}
+
+// Same as pt_load_mapping() but leaves the text empty; the mapping is
+// then handed over piece by piece through pt_extend_original().
+void pt_begin_mapping(Piece_Table* pt, char* mapping, size_t size)
+{
+  pt_begin_original(pt, mapping, false);
+  pt->mapping = mapping;
+  pt->mapping_size = size;
+}
+
+void pt_free(Piece_Table* pt)
+{
+  for (size_t i = 0; i < pt->buffers_size; ++i) {
+    if (pt->buffers[i].owned) {
+      free(pt->buffers[i].data);
+    }
+    lf_index_free(&pt->buffers[i].index);
+  }
+  free(pt->buffers);
+  pt_directory_release(pt->directory);
+  pool_free(&pt->nodes);
+  if (pt->mapping != NULL) {
+    munmap(pt->mapping, pt->mapping_size);
+  }
+  memset(pt, 0, sizeof(*pt));
+}
+
+// Returns the piece the text was stored in, which stays valid for as
+// long as the table: add buffers are never rewritten.
+Piece pt_insert(Piece_Table* pt, size_t offset, const char* text,
+                size_t text_size)
+{
+  if (text_size == 0) {
+    return (Piece){0};
+  }
+  if (offset > pt->size) {
+    offset = pt->size;
+  }
+
+  const Piece piece = pt_append_add(pt, text, text_size);
+  pt_insert_piece(pt, offset, piece);
+  return piece;
+}
+
+void pt_delete(Piece_Table* pt, size_t offset, size_t count)
+{
+  if (offset >= pt->size) {
+    return;
+  }
+  if (count > pt->size - offset) {
+    count = pt->size - offset;
+  }
+  if (count == 0) {
+    return;
+  }
+
+  pt_grow_root(pt,
+               node_delete(pt, node_own(pt, &pt->root), offset, count));
+}
+
+size_t pt_rows(const Piece_Table* pt)
+{
+  return pt->lf_count + 1;
+}
+
+size_t pt_line_start(const Piece_Table* pt, size_t row)
+{
+  if (row > pt->lf_count) {
+    row = pt->lf_count;
+  }
+  if (row == 0) {
+    return 0;
+  }
+
+  const Pt_Node* node = pt->root;
+  size_t offset = 0;
+  while (!node->leaf) {
+    size_t i = 0;
+    while (row > node->children[i]->lf_count) {
+      row -= node->children[i]->lf_count;
+      offset += node->children[i]->size;
+      i += 1;
+    }
+    node = node->children[i];
+  }
+
+  for (size_t i = 0; i < node->count; ++i) {
+    const Piece* piece = &node->pieces[i];
+    if (row <= piece->lf_count) {
+      const Pt_Buffer* buffer = &pt->buffers[piece->buffer];
+      const Lf_Index* index = &buffer->index;
+      size_t lf = lf_index_lower_bound(index, piece->start) + row - 1;
+      return offset + index->lfs[lf] - piece->start + 1;
+    }
+    row -= piece->lf_count;
+    offset += piece->size;
+  }
+
+  assert(0 && "unreachable: row is within the cached line-feed count");
+  return pt->size;
+}
+
+// Row of the line the byte at offset belongs to
+size_t pt_row_of(const Piece_Table* pt, size_t offset)
+{
+  if (pt->root == NULL) {
+    return 0;
+  }
+  if (offset > pt->size) {
+    offset = pt->size;
+  }
+
+  const Pt_Node* node = pt->root;
+  size_t row = 0;
+  while (!node->leaf) {
+    size_t i = 0;
+    while (i + 1 < node->count && offset >= node->children[i]->size) {
+      offset -= node->children[i]->size;
+      row += node->children[i]->lf_count;
+      i += 1;
+    }
+    node = node->children[i];
+  }
+
+  for (size_t i = 0; i < node->count; ++i) {
+    const Piece* piece = &node->pieces[i];
+    if (offset < piece->size || i + 1 == node->count) {
+      const Lf_Index* index = &pt->buffers[piece->buffer].index;
+      return row + lf_index_lower_bound(index, piece->start + offset) -
+             lf_index_lower_bound(index, piece->start);
+    }
+    offset -= piece->size;
+    row += piece->lf_count;
+  }
+  return row;
+}
+
+size_t pt_line_size(const Piece_Table* pt, size_t row)
+{
+  size_t start = pt_line_start(pt, row);
+  if (row + 1 < pt_rows(pt)) {
+    return pt_line_start(pt, row + 1) - 1 - start;
+  }
+  return pt->size - start;
+}
+
+const char* pt_char_at(const Piece_Table* pt, size_t offset)
+{
+  if (offset >= pt->size) {
+    return NULL;
+  }
+
+  Pt_Iter it = pt_iter(pt, offset, offset + 1);
+  String_View chunk = {0};
+  return pt_iter_next(&it, &chunk) ? chunk.data : NULL;
+}
+
+static Pt_Iter pt_iter_tree(const Pt_Node* root, size_t size,
+                            char* const* data, size_t offset, size_t end)
+{
+  if (end > size) {
+    end = size;
+  }
+  if (offset > end) {
+    offset = end;
+  }
+
+  Pt_Iter it = {.data = data, .remaining = end - offset};
+  if (it.remaining == 0) {
+    return it;
+  }
+
+  const Pt_Node* node = root;
+  while (true) {
+    assert(it.depth < PT_MAX_DEPTH);
+    size_t i = 0;
+    if (node->leaf) {
+      while (offset >= node->pieces[i].size) {
+        offset -= node->pieces[i].size;
+        i += 1;
+      }
+    } else {
+      while (offset >= node->children[i]->size) {
+        offset -= node->children[i]->size;
+        i += 1;
+      }
+    }
+
+    it.nodes[it.depth] = node;
+    it.indices[it.depth] = i;
+    it.depth += 1;
+
+    if (node->leaf) {
+      break;
+    }
+    node = node->children[i];
+  }
+  it.local = offset;
+
+  return it;
+}
+
+Pt_Iter pt_iter(const Piece_Table* pt, size_t offset, size_t end)
+{
+  Pt_Iter it =
+      pt_iter_tree(pt->root, pt->size,
+                   pt->directory != NULL ? pt->directory->data : NULL,
+                   offset, end);
+  it.pt = pt;
+  return it;
+}
+
+// Moves the iterator to the first piece of the next leaf
+static bool pt_iter_next_leaf(Pt_Iter* it)
+{
+  size_t level = it->depth - 1;
+  while (level > 0 &&
+         it->indices[level - 1] + 1 >= it->nodes[level - 1]->count) {
+    level -= 1;
+  }
+  if (level == 0) {
+    return false;
+  }
+
+  it->indices[level - 1] += 1;
+  for (; level < it->depth; ++level) {
+    it->nodes[level] = it->nodes[level - 1]->children[it->indices[level - 1]];
+    it->indices[level] = 0;
+  }
+  return true;
+}
+
+bool pt_iter_next(Pt_Iter* it, String_View* chunk)
+{
+  while (it->remaining > 0) {
+    const Pt_Node* leaf = it->nodes[it->depth - 1];
+    size_t* i = &it->indices[it->depth - 1];
+
+    if (*i >= leaf->count) {
+      if (!pt_iter_next_leaf(it)) {
+        it->remaining = 0;
+        return false;
+      }
+      continue;
+    }
+
+    const Piece* piece = &leaf->pieces[*i];
+    if (it->local >= piece->size) {
+      *i += 1;
+      it->local = 0;
+      continue;
+    }
+
+    size_t n = piece->size - it->local;
+    if (n > it->remaining) {
+      n = it->remaining;
+    }
+    chunk->data = it->data[piece->buffer] + piece->start + it->local;
+    chunk->count = n;
+    it->local += n;
+    it->remaining -= n;
+    return true;
+  }
+  return false;
+}
+
+// Like pt_iter_next() but yields the pieces under the iterated range,
+// trimmed to it, instead of their text
+bool pt_iter_next_piece(Pt_Iter* it, Piece* piece)
+{
+  assert(it->pt != NULL && "Snapshots have no line index to make pieces");
+
+  String_View chunk = {0};
+  if (!pt_iter_next(it, &chunk)) {
+    return false;
+  }
+
+  const Pt_Node* leaf = it->nodes[it->depth - 1];
+  const Piece* current = &leaf->pieces[it->indices[it->depth - 1]];
+  *piece = pt_piece(it->pt, current->buffer,
+                    current->start + it->local - chunk.count, chunk.count);
+  return true;
+}
+
+// Takes a snapshot of the text in O(1): it shares the tree with the table
+// and keeps it alive until pt_snapshot_release()
+Pt_Snapshot pt_snapshot(Piece_Table* pt)
+{
+  Pt_Snapshot snapshot = {
+      .root = pt->root,
+      .directory = pt->directory,
+      .size = pt->size,
+      .lf_count = pt->lf_count,
+  };
+  if (snapshot.root != NULL) {
+    snapshot.root->refs += 1;
+  }
+  if (snapshot.directory != NULL) {
+    snapshot.directory->refs += 1;
+  }
+  return snapshot;
+}
+
+void pt_snapshot_release(Piece_Table* pt, Pt_Snapshot* snapshot)
+{
+  node_unref(pt, snapshot->root);
+  pt_directory_release(snapshot->directory);
+  memset(snapshot, 0, sizeof(*snapshot));
+}
+
+Pt_Iter pt_snapshot_iter(const Pt_Snapshot* snapshot, size_t offset,
+                         size_t end)
+{
+  return pt_iter_tree(
+      snapshot->root, snapshot->size,
+      snapshot->directory != NULL ? snapshot->directory->data : NULL,
+      offset, end);
+}
+
+Pt_Stats pt_stats(const Piece_Table* pt)
+{
+  Pt_Stats stats = {.node_bytes = pool_bytes(&pt->nodes)};
+  for (size_t i = 0; i < pt->buffers_size; ++i) {
+    const Pt_Buffer* buffer = &pt->buffers[i];
+    if (buffer->owned) {
+      stats.text_bytes +=
+          buffer->capacity > 0 ? buffer->capacity : buffer->size;
+    }
+    stats.index_bytes += lf_index_bytes(&buffer->index);
+  }
+  stats.index_bytes += pt->buffers_capacity * sizeof(pt->buffers[0]);
+  return stats;
+}
@@ -0,0 +1,138 @@
+#ifndef PIECE_TABLE_H_
+#define PIECE_TABLE_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "lf_index.h"
+#include "pool.h"
+#include "sv.h"
+
+#define PT_ADD_BUFFER_CAPACITY (64 * 1024)
+#define PT_NODE_MAX 32
+#define PT_MAX_DEPTH 24
+
+// A chunk of text the pieces point into. The original file is loaded
+// into a read-only buffer (capacity == 0), edits go to append-only add
+// buffers. Data of a buffer never moves once written.
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+  bool owned;
+  Lf_Index index;
+} Pt_Buffer;
+
+typedef struct {
+  size_t buffer;
+  size_t start;
+  size_t size;
+  size_t lf_count;
+} Piece;
+
+// Pieces live in the leaves of a B-tree. Every node caches the byte and
+// line-feed counts of its subtree, so locating an offset or a row and
+// splicing pieces in or out are all O(log n).
+typedef struct Pt_Node Pt_Node;
+struct Pt_Node {
+  // Parents and snapshots pointing to the node. Nodes with more than one
+  // reference are shared and copied before they are modified.
+  size_t refs;
+  bool leaf;
+  size_t count;
+  size_t size;
+  size_t lf_count;
+  union {
+    Pt_Node* children[PT_NODE_MAX];
+    Piece pieces[PT_NODE_MAX];
+  };
+};
+
+// Data pointers of the buffers, shared between the table and its
+// snapshots
+typedef struct {
+  size_t refs;
+  size_t capacity;
+  size_t size;
+  char* data[];
+} Pt_Directory;
+
+typedef struct {
+  size_t buffers_capacity;
+  size_t buffers_size;
+  Pt_Buffer* buffers;
+  Pt_Directory* directory;
+
+  // Read-only mapping of the original file, if it was mmap()ed
+  char* mapping;
+  size_t mapping_size;
+
+  Pool nodes;
+  Pt_Node* root;
+  size_t size;
+  size_t lf_count;
+} Piece_Table;
+
+// Read-only view of the text as it was when the snapshot was taken. The
+// table copies shared nodes instead of modifying them and never rewrites
+// buffer bytes, so a snapshot can be read from any thread while the
+// table keeps changing. Snapshots are taken and released by the thread
+// that owns the table, and all of them before pt_free().
+typedef struct {
+  Pt_Node* root;
+  Pt_Directory* directory;
+  size_t size;
+  size_t lf_count;
+} Pt_Snapshot;
+
+typedef struct {
+  // NULL when iterating a snapshot
+  const Piece_Table* pt;
+  char* const* data;
+  size_t depth;
+  const Pt_Node* nodes[PT_MAX_DEPTH];
+  size_t indices[PT_MAX_DEPTH];
+  size_t local;
+  size_t remaining;
+} Pt_Iter;
+
+typedef struct {
+  size_t text_bytes;
+  size_t index_bytes;
+  size_t node_bytes;
+} Pt_Stats;
+
+void pt_load_original(Piece_Table* pt, char* data, size_t size, bool owned);
+void pt_load_mapping(Piece_Table* pt, char* mapping, size_t size);
+void pt_load_mapping_indexed(Piece_Table* pt, char* mapping, size_t size,
+                             Lf_Index* index);
+void pt_begin_original(Piece_Table* pt, char* data, bool owned);
+void pt_begin_mapping(Piece_Table* pt, char* mapping, size_t size);
+void pt_extend_original(Piece_Table* pt, size_t size, const Lf_Index* index);
+void pt_free(Piece_Table* pt);
+
+Piece pt_piece(const Piece_Table* pt, size_t buffer, size_t start,
+               size_t size);
+Piece pt_append_add(Piece_Table* pt, const char* text, size_t text_size);
+Piece pt_insert(Piece_Table* pt, size_t offset, const char* text,
+                size_t text_size);
+void pt_insert_piece(Piece_Table* pt, size_t offset, Piece piece);
+void pt_delete(Piece_Table* pt, size_t offset, size_t count);
+
+size_t pt_rows(const Piece_Table* pt);
+size_t pt_line_start(const Piece_Table* pt, size_t row);
+size_t pt_line_size(const Piece_Table* pt, size_t row);
+size_t pt_row_of(const Piece_Table* pt, size_t offset);
+const char* pt_char_at(const Piece_Table* pt, size_t offset);
+
+Pt_Iter pt_iter(const Piece_Table* pt, size_t offset, size_t end);
+bool pt_iter_next(Pt_Iter* it, String_View* chunk);
+bool pt_iter_next_piece(Pt_Iter* it, Piece* piece);
+
+Pt_Snapshot pt_snapshot(Piece_Table* pt);
+void pt_snapshot_release(Piece_Table* pt, Pt_Snapshot* snapshot);
+Pt_Iter pt_snapshot_iter(const Pt_Snapshot* snapshot, size_t offset,
+                         size_t end);
+
+Pt_Stats pt_stats(const Piece_Table* pt);
+
+#endif  // PIECE_TABLE_H_
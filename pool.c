@@ -0,0 +1,76 @@
+#include "./pool.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+struct Pool_Slab {
+  Pool_Slab* next;
+  max_align_t objects[];
+};
+
+static size_t pool_stride(const Pool* pool)
+{
+  const size_t align = sizeof(max_align_t);
+  size_t size = pool->object_size < sizeof(void*) ? sizeof(void*)
+                                                  : pool->object_size;
+  return (size + align - 1) / align * align;
+}
+
+void* pool_alloc(Pool* pool)
+{
+  assert(pool->object_size > 0);
+
+  if (pool->free_list == NULL) {
+    const size_t stride = pool_stride(pool);
+    Pool_Slab* slab =
+        malloc(sizeof(Pool_Slab) + stride * POOL_SLAB_OBJECTS);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slabs_count += 1;
+
+    char* objects = (char*)slab->objects;
+    for (size_t i = POOL_SLAB_OBJECTS; i > 0; --i) {
+      void* object = objects + (i - 1) * stride;
+      *(void**)object = pool->free_list;
+      pool->free_list = object;
+    }
+  }
+
+  void* object = pool->free_list;
+  pool->free_list = *(void**)object;
+  pool->in_use += 1;
+  memset(object, 0, pool->object_size);
+  return object;
+}
+
+void pool_release(Pool* pool, void* object)
+{
+  if (object == NULL) {
+    return;
+  }
+  assert(pool->in_use > 0);
+  *(void**)object = pool->free_list;
+  pool->free_list = object;
+  pool->in_use -= 1;
+}
+
+void pool_free(Pool* pool)
+{
+  Pool_Slab* slab = pool->slabs;
+  while (slab != NULL) {
+    Pool_Slab* next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->slabs_count = 0;
+  pool->free_list = NULL;
+  pool->in_use = 0;
+}
+
+size_t pool_bytes(const Pool* pool)
+{
+  return pool->slabs_count *
+         (sizeof(Pool_Slab) + pool_stride(pool) * POOL_SLAB_OBJECTS);
+}
@@ -0,0 +1,26 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdlib.h>
+
+#define POOL_SLAB_OBJECTS 64
+
+// Fixed-size object allocator. Objects are carved out of slabs of
+// POOL_SLAB_OBJECTS at a time, recycled through a free list and all
+// released at once by pool_free().
+typedef struct Pool_Slab Pool_Slab;
+
+typedef struct {
+  size_t object_size;
+  Pool_Slab* slabs;
+  size_t slabs_count;
+  void* free_list;
+  size_t in_use;
+} Pool;
+
+void* pool_alloc(Pool* pool);
+void pool_release(Pool* pool, void* object);
+void pool_free(Pool* pool);
+size_t pool_bytes(const Pool* pool);
+
+#endif  // POOL_H_
@@ -0,0 +1,231 @@
+#include "./save.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "./io.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX SAVE_IOV_BATCH
+#endif
+
+static double save_now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool save_fail(Save_Result* result, const char* failed)
+{
+  result->failed = failed;
+  result->error = errno;
+  return false;
+}
+
+static bool save_flush(Io_Writer* writer, struct iovec* iov, size_t* count,
+                       Save_Progress_Fn progress, void* progress_data,
+                       Save_Result* result)
+{
+  if (!io_writer_write(writer, iov, *count)) {
+    return save_fail(result, "write");
+  }
+  *count = 0;
+  if (progress != NULL) {
+    progress(progress_data, writer->written);
+  }
+  return true;
+}
+
+// Hands the chunks of the text to the kernel straight from the piece
+// buffers, up to a batch of iovecs per request, with several requests in
+// flight when io_uring is available. Batches are also cut every
+// SAVE_FLUSH_BYTES so progress can be reported on huge pieces.
+static bool save_write_text(int fd, Pt_Iter* it, Save_Progress_Fn progress,
+                            void* progress_data, Save_Result* result)
+{
+  struct iovec iov[SAVE_IOV_BATCH];
+  const size_t batch = IOV_MAX < SAVE_IOV_BATCH ? IOV_MAX : SAVE_IOV_BATCH;
+  size_t count = 0;
+  size_t pending = 0;
+
+  Io_Writer writer;
+  io_writer_init(&writer, fd);
+
+  bool ok = true;
+  String_View chunk = {0};
+  while (ok && pt_iter_next(it, &chunk)) {
+    while (ok && chunk.count > 0) {
+      const size_t n = chunk.count < SAVE_FLUSH_BYTES - pending
+                           ? chunk.count
+                           : SAVE_FLUSH_BYTES - pending;
+      iov[count].iov_base = (void*)chunk.data;
+      iov[count].iov_len = n;
+      count += 1;
+      pending += n;
+      sv_chop_left(&chunk, n);
+
+      if (count == batch || pending == SAVE_FLUSH_BYTES) {
+        ok = save_flush(&writer, iov, &count, progress, progress_data,
+                        result);
+        pending = 0;
+      }
+    }
+  }
+  if (ok && count > 0) {
+    ok = save_flush(&writer, iov, &count, progress, progress_data, result);
+  }
+
+  result->backend = writer.ring.fd >= 0 ? "io_uring" : "pwritev";
+  // Writes still in flight point into the text, they finish first
+  if (!io_writer_finish(&writer) && ok) {
+    ok = save_fail(result, "write");
+  }
+  result->bytes = writer.written;
+  if (ok && progress != NULL) {
+    progress(progress_data, writer.written);
+  }
+  return ok;
+}
+
+// Compresses the text on the way out. The output goes through plain
+// write()s: it lives in a buffer that is reused, unlike the text.
+static bool save_write_compressed(int fd, Pt_Iter* it,
+                                  Compress_Format format,
+                                  Save_Progress_Fn progress,
+                                  void* progress_data, Save_Result* result)
+{
+  result->backend = compress_format_name(format);
+  if (!compress_deflate(fd, format, it, progress, progress_data,
+                        &result->bytes)) {
+    return save_fail(result, "compressing");
+  }
+  return true;
+}
+
+// Creates a file that did not exist before next to path. O_EXCL makes
+// sure nothing is clobbered; the mode is subject to the umask as for any
+// new file.
+static int save_open_temp(const char* path, char* temp, size_t temp_size)
+{
+  const char* slash = strrchr(path, '/');
+  const int dir_size = slash != NULL ? (int)(slash - path + 1) : 0;
+  const char* name = slash != NULL ? slash + 1 : path;
+
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    const int n = snprintf(temp, temp_size, "%.*s.%s.%ld-%d.jed-save",
+                           dir_size, path, name, (long)getpid(), attempt);
+    if (n < 0 || (size_t)n >= temp_size) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    const int fd =
+        open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd >= 0 || errno != EEXIST) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+// Makes the rename itself durable. Not every file system supports
+// syncing a directory, so this is best effort.
+static void save_sync_directory(const char* path)
+{
+  char dir[PATH_MAX];
+  const char* slash = strrchr(path, '/');
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else if ((size_t)(slash - path) < sizeof(dir)) {
+    memcpy(dir, path, (size_t)(slash - path));
+    dir[slash - path] = '\0';
+  } else {
+    return;
+  }
+
+  const int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+// Writes the text of it to a temporary file in the directory of
+// file_path, syncs it and renames it over file_path, so that the file is
+// either entirely old or entirely new whatever happens in between. A
+// symlink is followed and the file it points to replaced. Returns false
+// and leaves the file untouched on failure, with the reason in result.
+// The text is compressed in format, which is that of the file as it was
+// loaded rather than whatever its name suggests.
+bool save_atomic(const char* file_path, Pt_Iter it, Compress_Format format,
+                 Save_Progress_Fn progress, void* progress_data,
+                 Save_Result* result)
+{
+  memset(result, 0, sizeof(*result));
+  const double begin = save_now_seconds();
+
+  char* real_path = realpath(file_path, NULL);
+  const char* path = real_path != NULL ? real_path : file_path;
+
+  char temp[PATH_MAX + 64];
+  const int fd = save_open_temp(path, temp, sizeof(temp));
+  if (fd < 0) {
+    free(real_path);
+    return save_fail(result, "creating a temporary file");
+  }
+
+  bool ok = format != COMPRESS_NONE && compress_supported(format)
+                ? save_write_compressed(fd, &it, format, progress,
+                                        progress_data, result)
+                : save_write_text(fd, &it, progress, progress_data, result);
+
+  // The new file takes over the permissions of the one it replaces
+  struct stat st;
+  if (ok && stat(path, &st) == 0 && fchmod(fd, st.st_mode & 07777) < 0) {
+    ok = save_fail(result, "copying permissions");
+  }
+  if (ok && fsync(fd) < 0) {
+    ok = save_fail(result, "fsync");
+  }
+  if (close(fd) < 0 && ok) {
+    ok = save_fail(result, "close");
+  }
+  if (ok && rename(temp, path) < 0) {
+    ok = save_fail(result, "rename");
+  }
+
+  if (ok) {
+    save_sync_directory(path);
+  } else {
+    unlink(temp);
+  }
+
+  free(real_path);
+  result->seconds = save_now_seconds() - begin;
+  return ok;
+}
+
+void save_print_result(const Save_Result* result, const char* file_path,
+                       FILE* stream)
+{
+  if (result->failed != NULL) {
+    fprintf(stream, "ERROR: could not save `%s`: %s failed: %s\n",
+            file_path, result->failed, strerror(result->error));
+    return;
+  }
+
+  fprintf(stream, "Saved %zu bytes to `%s` in %.3f s (%.2f GB/s, %s)\n",
+          result->bytes, file_path, result->seconds,
+          result->seconds > 0.0
+              ? (double)result->bytes / 1e9 / result->seconds
+              : 0.0,
+          result->backend);
+}
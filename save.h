@@ -0,0 +1,32 @@
+#ifndef SAVE_H_
+#define SAVE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "compress.h"
+#include "piece_table.h"
+
+#define SAVE_IOV_BATCH 1024
+#define SAVE_FLUSH_BYTES (8 * 1024 * 1024)
+
+typedef struct {
+  size_t bytes;
+  double seconds;
+  const char* backend;
+
+  // On failure: the step that failed and its errno
+  const char* failed;
+  int error;
+} Save_Result;
+
+// Called with the number of bytes written so far
+typedef void (*Save_Progress_Fn)(void* data, size_t written);
+
+bool save_atomic(const char* file_path, Pt_Iter it, Compress_Format format,
+                 Save_Progress_Fn progress, void* progress_data,
+                 Save_Result* result);
+void save_print_result(const Save_Result* result, const char* file_path,
+                       FILE* stream);
+
+#endif  // SAVE_H_
@@ -0,0 +1,105 @@
+#include "./saver.h"
+
+#include <string.h>
+
+static void saver_report(void* data, size_t written)
+{
+  Saver* saver = data;
+  pthread_mutex_lock(&saver->mutex);
+  saver->written = written;
+  pthread_mutex_unlock(&saver->mutex);
+}
+
+static void* saver_run(void* arg)
+{
+  Saver* saver = arg;
+  Save_Result result;
+  save_atomic(saver->file_path,
+              pt_snapshot_iter(&saver->snapshot, 0, saver->snapshot.size),
+              saver->format, saver_report, saver, &result);
+
+  pthread_mutex_lock(&saver->mutex);
+  saver->result = result;
+  saver->done = true;
+  pthread_mutex_unlock(&saver->mutex);
+  return NULL;
+}
+
+// Starts saving the current text of pt to file_path in format. Returns
+// false if a save is still running or no thread could be started.
+bool saver_start(Saver* saver, Piece_Table* pt, const char* file_path,
+                 Compress_Format format)
+{
+  if (saver->running) {
+    return false;
+  }
+
+  memset(saver, 0, sizeof(*saver));
+  if (pthread_mutex_init(&saver->mutex, NULL) != 0) {
+    return false;
+  }
+  saver->snapshot = pt_snapshot(pt);
+  saver->file_path = strdup(file_path);
+  saver->format = format;
+  if (pthread_create(&saver->thread, NULL, saver_run, saver) != 0) {
+    pt_snapshot_release(pt, &saver->snapshot);
+    free(saver->file_path);
+    pthread_mutex_destroy(&saver->mutex);
+    return false;
+  }
+  saver->running = true;
+  return true;
+}
+
+static void saver_finish(Saver* saver, Piece_Table* pt, Save_Result* result)
+{
+  pthread_join(saver->thread, NULL);
+  pthread_mutex_destroy(&saver->mutex);
+  pt_snapshot_release(pt, &saver->snapshot);
+  free(saver->file_path);
+  saver->file_path = NULL;
+  *result = saver->result;
+  saver->running = false;
+}
+
+// Returns true once, when the running save has finished, with its outcome
+// in result
+bool saver_poll(Saver* saver, Piece_Table* pt, Save_Result* result)
+{
+  if (!saver->running) {
+    return false;
+  }
+
+  pthread_mutex_lock(&saver->mutex);
+  const bool done = saver->done;
+  pthread_mutex_unlock(&saver->mutex);
+
+  if (done) {
+    saver_finish(saver, pt, result);
+  }
+  return done;
+}
+
+// Blocks until the running save, if any, has finished. Returns false if
+// there was none. Saves are never cancelled halfway: the old file would
+// stay intact, but the user asked for the new one.
+bool saver_wait(Saver* saver, Piece_Table* pt, Save_Result* result)
+{
+  if (!saver->running) {
+    return false;
+  }
+  saver_finish(saver, pt, result);
+  return true;
+}
+
+float saver_progress(Saver* saver)
+{
+  if (!saver->running || saver->snapshot.size == 0) {
+    return 1.0f;
+  }
+
+  pthread_mutex_lock(&saver->mutex);
+  const size_t written = saver->written;
+  pthread_mutex_unlock(&saver->mutex);
+  return (float)written / (float)saver->snapshot.size;
+}
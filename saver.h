@@ -0,0 +1,32 @@
+#ifndef SAVER_H_
+#define SAVER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "piece_table.h"
+#include "save.h"
+
+// Saves a snapshot of the text on a background thread so the editor
+// stays responsive. The snapshot is taken and released by the thread
+// that owns the table, in saver_start() and saver_poll().
+typedef struct {
+  pthread_t thread;
+  bool running;
+  Pt_Snapshot snapshot;
+  char* file_path;
+  Compress_Format format;
+
+  pthread_mutex_t mutex;
+  size_t written;
+  bool done;
+  Save_Result result;
+} Saver;
+
+bool saver_start(Saver* saver, Piece_Table* pt, const char* file_path,
+                 Compress_Format format);
+bool saver_poll(Saver* saver, Piece_Table* pt, Save_Result* result);
+bool saver_wait(Saver* saver, Piece_Table* pt, Save_Result* result);
+float saver_progress(Saver* saver);
+
+#endif  // SAVER_H_
@@ -0,0 +1,139 @@
+#include "./stream.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+static void* streamer_run(void* arg)
+{
+  Streamer* streamer = arg;
+  char* chunk = malloc(STREAM_READ_CHUNK);
+  int error = 0;
+
+  while (true) {
+    // Waits a little at a time so that a stop request is noticed even if
+    // the writer goes quiet; once poll() says so, read() returns what is
+    // there without blocking
+    struct pollfd pfd = {.fd = streamer->fd, .events = POLLIN};
+    const int ready = poll(&pfd, 1, STREAM_POLL_MS);
+    pthread_mutex_lock(&streamer->mutex);
+    const bool cancel = streamer->cancel;
+    pthread_mutex_unlock(&streamer->mutex);
+    if (cancel) {
+      break;
+    }
+    if (ready < 0 && errno != EINTR) {
+      error = errno;
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    const ssize_t n = read(streamer->fd, chunk, STREAM_READ_CHUNK);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      error = n < 0 ? errno : 0;
+      break;
+    }
+
+    pthread_mutex_lock(&streamer->mutex);
+    if (streamer->pending_capacity - streamer->pending_size < (size_t)n) {
+      if (streamer->pending_capacity == 0) {
+        streamer->pending_capacity = STREAM_READ_CHUNK;
+      }
+      while (streamer->pending_capacity - streamer->pending_size <
+             (size_t)n) {
+        streamer->pending_capacity *= 2;
+      }
+      streamer->pending =
+          realloc(streamer->pending, streamer->pending_capacity);
+    }
+    memcpy(streamer->pending + streamer->pending_size, chunk, (size_t)n);
+    streamer->pending_size += (size_t)n;
+    streamer->total += (size_t)n;
+    pthread_mutex_unlock(&streamer->mutex);
+  }
+  free(chunk);
+
+  pthread_mutex_lock(&streamer->mutex);
+  streamer->done = true;
+  streamer->error = error;
+  pthread_mutex_unlock(&streamer->mutex);
+  return NULL;
+}
+
+bool streamer_start(Streamer* streamer, int fd)
+{
+  memset(streamer, 0, sizeof(*streamer));
+  streamer->fd = fd;
+
+  if (pthread_mutex_init(&streamer->mutex, NULL) != 0) {
+    return false;
+  }
+  if (pthread_create(&streamer->thread, NULL, streamer_run, streamer) !=
+      0) {
+    pthread_mutex_destroy(&streamer->mutex);
+    return false;
+  }
+  streamer->running = true;
+  return true;
+}
+
+// Appends what was read since the last poll to the end of pt, indexing
+// only those bytes. Returns true while more input may come.
+bool streamer_poll(Streamer* streamer, Piece_Table* pt, size_t* appended)
+{
+  *appended = 0;
+  if (!streamer->running) {
+    return false;
+  }
+
+  pthread_mutex_lock(&streamer->mutex);
+  char* data = streamer->pending;
+  const size_t size = streamer->pending_size;
+  const size_t capacity = streamer->pending_capacity;
+  streamer->pending = streamer->spare;
+  streamer->pending_capacity = streamer->spare_capacity;
+  streamer->pending_size = 0;
+  const bool done = streamer->done;
+  pthread_mutex_unlock(&streamer->mutex);
+
+  if (size > 0) {
+    pt_insert(pt, pt->size, data, size);
+    *appended = size;
+  }
+  streamer->spare = data;
+  streamer->spare_capacity = capacity;
+
+  if (done) {
+    if (streamer->error != 0) {
+      fprintf(stderr, "ERROR: could not read input: %s\n",
+              strerror(streamer->error));
+    }
+    streamer_stop(streamer);
+    return false;
+  }
+  return true;
+}
+
+// Stops reading, whether or not the input has ended
+void streamer_stop(Streamer* streamer)
+{
+  if (!streamer->running) {
+    return;
+  }
+
+  pthread_mutex_lock(&streamer->mutex);
+  streamer->cancel = true;
+  pthread_mutex_unlock(&streamer->mutex);
+  pthread_join(streamer->thread, NULL);
+  pthread_mutex_destroy(&streamer->mutex);
+  free(streamer->pending);
+  free(streamer->spare);
+  memset(streamer, 0, sizeof(*streamer));
+}
@@ -0,0 +1,38 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+#define STREAM_READ_CHUNK (1024 * 1024)
+#define STREAM_POLL_MS 100
+
+// Reads a pipe, e.g. stdin, on a background thread. Whatever arrives is
+// handed over to the thread that owns the piece table through
+// streamer_poll(), without waiting for the end of the input.
+typedef struct {
+  int fd;
+  pthread_t thread;
+  bool running;
+
+  pthread_mutex_t mutex;
+  size_t pending_capacity;
+  size_t pending_size;
+  char* pending;
+  size_t total;
+  bool done;
+  bool cancel;
+  int error;
+
+  // Buffer swapped with pending on every poll
+  size_t spare_capacity;
+  char* spare;
+} Streamer;
+
+bool streamer_start(Streamer* streamer, int fd);
+bool streamer_poll(Streamer* streamer, Piece_Table* pt, size_t* appended);
+void streamer_stop(Streamer* streamer);
+
+#endif  // STREAM_H_
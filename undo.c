@@ -0,0 +1,296 @@
+#include "./undo.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define UNDO_INIT_PIECES 16
+
+static size_t undo_record_length(const Undo_Record* record)
+{
+  return sizeof(*record) +
+         (record->removed_count + record->inserted_count) * sizeof(Piece) +
+         sizeof(size_t);
+}
+
+static void undo_ring_write(Undo* undo, size_t position, const void* data,
+                            size_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  const size_t at = position % undo->budget;
+  const size_t first = size < undo->budget - at ? size : undo->budget - at;
+  memcpy(undo->ring + at, data, first);
+  memcpy(undo->ring, (const char*)data + first, size - first);
+}
+
+static void undo_ring_read(const Undo* undo, size_t position, void* data,
+                           size_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  const size_t at = position % undo->budget;
+  const size_t first = size < undo->budget - at ? size : undo->budget - at;
+  memcpy(data, undo->ring + at, first);
+  memcpy((char*)data + first, undo->ring, size - first);
+}
+
+static void undo_pieces_reserve(Undo* undo, size_t n)
+{
+  if (undo->pieces_capacity >= n) {
+    return;
+  }
+
+  size_t new_capacity =
+      undo->pieces_capacity == 0 ? UNDO_INIT_PIECES : undo->pieces_capacity;
+  while (new_capacity < n) {
+    new_capacity *= 2;
+  }
+  undo->pieces = realloc(undo->pieces, new_capacity * sizeof(Piece));
+  undo->pieces_capacity = new_capacity;
+}
+
+// Reads the record at position along with its pieces, which end up in
+// undo->pieces
+static size_t undo_read(Undo* undo, size_t position, Undo_Record* record)
+{
+  undo_ring_read(undo, position, record, sizeof(*record));
+  undo->pieces_size = record->removed_count + record->inserted_count;
+  undo_pieces_reserve(undo, undo->pieces_size);
+  undo_ring_read(undo, position + sizeof(*record), undo->pieces,
+                 undo->pieces_size * sizeof(Piece));
+  return undo_record_length(record);
+}
+
+// Drops the history, e.g. because it no longer fits the budget or the
+// text it refers to was replaced
+void undo_clear(Undo* undo)
+{
+  undo->head = undo->tail;
+  undo->current = undo->tail;
+  undo->open = false;
+}
+
+void undo_set_budget(Undo* undo, size_t budget)
+{
+  free(undo->ring);
+  undo->ring = NULL;
+  undo->budget = budget;
+  undo_clear(undo);
+}
+
+void undo_free(Undo* undo)
+{
+  free(undo->ring);
+  free(undo->pieces);
+  memset(undo, 0, sizeof(*undo));
+}
+
+void undo_begin_group(Undo* undo)
+{
+  if (undo->group_depth++ == 0) {
+    undo->groups += 1;
+    undo->open = false;
+  }
+}
+
+void undo_end_group(Undo* undo)
+{
+  assert(undo->group_depth > 0);
+  if (--undo->group_depth == 0) {
+    undo->open = false;
+  }
+}
+
+// Makes the next edit start a record of its own, e.g. after the cursor
+// was moved away
+void undo_seal(Undo* undo)
+{
+  undo->open = false;
+}
+
+// Returns the pieces holding [offset, offset + count) of the table,
+// which is what an edit of that range is about to remove
+const Piece* undo_collect(Undo* undo, const Piece_Table* pt, size_t offset,
+                          size_t count, size_t* pieces_count)
+{
+  undo->pieces_size = 0;
+  Pt_Iter it = pt_iter(pt, offset, offset + count);
+  Piece piece = {0};
+  while (pt_iter_next_piece(&it, &piece)) {
+    undo_pieces_reserve(undo, undo->pieces_size + 1);
+    undo->pieces[undo->pieces_size++] = piece;
+  }
+  *pieces_count = undo->pieces_size;
+  return undo->pieces;
+}
+
+// Folds a one-piece edit into the newest record when it continues a run
+// of typing, backspacing or deleting. Both pieces of the run sit next to
+// each other in one buffer then, so the record keeps its length and is
+// simply rewritten in place. Line breaks end a run.
+static bool undo_coalesce(Undo* undo, const Undo_Record* record,
+                          Piece next)
+{
+  if (!undo->open || undo->group_depth > 0 ||
+      undo->current == undo->head) {
+    return false;
+  }
+
+  size_t length = 0;
+  undo_ring_read(undo, undo->current - sizeof(length), &length,
+                 sizeof(length));
+  const size_t position = undo->current - length;
+  Undo_Record last;
+  undo_ring_read(undo, position, &last, sizeof(last));
+  if (last.removed_count + last.inserted_count != 1) {
+    return false;
+  }
+
+  Piece piece;
+  undo_ring_read(undo, position + sizeof(last), &piece, sizeof(piece));
+  if (piece.buffer != next.buffer || piece.lf_count > 0 ||
+      next.lf_count > 0) {
+    return false;
+  }
+
+  if (last.inserted_count == 1 && record->inserted_count == 1) {
+    if (record->offset != last.offset + last.inserted_size ||
+        piece.start + piece.size != next.start) {
+      return false;
+    }
+    last.inserted_size += next.size;
+  } else if (last.removed_count == 1 && record->removed_count == 1) {
+    if (record->offset + record->removed_size == last.offset &&
+        next.start + next.size == piece.start) {
+      last.offset = record->offset;
+      piece.start = next.start;
+    } else if (record->offset != last.offset ||
+               piece.start + piece.size != next.start) {
+      return false;
+    }
+    last.removed_size += next.size;
+  } else {
+    return false;
+  }
+  piece.size += next.size;
+
+  undo_ring_write(undo, position, &last, sizeof(last));
+  undo_ring_write(undo, position + sizeof(last), &piece, sizeof(piece));
+  return true;
+}
+
+void undo_push(Undo* undo, const Undo_Record* record, const Piece* removed,
+               const Piece* inserted)
+{
+  // A new edit forks the history: whatever could be redone is lost
+  undo->tail = undo->current;
+
+  if (record->removed_count + record->inserted_count == 1 &&
+      undo_coalesce(undo, record,
+                    record->inserted_count == 1 ? inserted[0]
+                                                : removed[0])) {
+    return;
+  }
+
+  if (undo->ring == NULL) {
+    if (undo->budget == 0) {
+      undo->budget = UNDO_DEFAULT_BUDGET;
+    }
+    undo->ring = malloc(undo->budget);
+  }
+
+  Undo_Record header = *record;
+  if (undo->group_depth == 0) {
+    undo->groups += 1;
+  }
+  header.group = undo->groups;
+
+  // A group that outgrew the budget cannot be undone in full, so none of
+  // it is kept
+  const size_t length = undo_record_length(&header);
+  if (header.group == undo->dropped_group || length > undo->budget) {
+    undo->dropped_group = header.group;
+    undo_clear(undo);
+    return;
+  }
+
+  // Only whole groups are evicted, so whatever is left can be undone to
+  // a state the text was really in
+  while (undo->tail - undo->head + length > undo->budget) {
+    Undo_Record oldest;
+    undo_ring_read(undo, undo->head, &oldest, sizeof(oldest));
+    const size_t group = oldest.group;
+    if (group == header.group) {
+      undo->dropped_group = header.group;
+      undo_clear(undo);
+      return;
+    }
+    while (undo->head < undo->tail && oldest.group == group) {
+      undo->head += undo_record_length(&oldest);
+      if (undo->head < undo->tail) {
+        undo_ring_read(undo, undo->head, &oldest, sizeof(oldest));
+      }
+    }
+  }
+
+  size_t position = undo->tail;
+  undo_ring_write(undo, position, &header, sizeof(header));
+  position += sizeof(header);
+  undo_ring_write(undo, position, removed,
+                  header.removed_count * sizeof(Piece));
+  position += header.removed_count * sizeof(Piece);
+  undo_ring_write(undo, position, inserted,
+                  header.inserted_count * sizeof(Piece));
+  position += header.inserted_count * sizeof(Piece);
+  undo_ring_write(undo, position, &length, sizeof(length));
+
+  undo->tail += length;
+  undo->current = undo->tail;
+  undo->open = true;
+}
+
+// Moves back over the newest undoable record if it belongs to group, or
+// to any group when group is 0. The record's pieces, removed ones
+// first, stay valid until the log is used again.
+bool undo_step_back(Undo* undo, size_t group, Undo_Record* record,
+                    const Piece** pieces)
+{
+  if (undo->current == undo->head) {
+    return false;
+  }
+
+  size_t length = 0;
+  undo_ring_read(undo, undo->current - sizeof(length), &length,
+                 sizeof(length));
+  undo_ring_read(undo, undo->current - length, record, sizeof(*record));
+  if (group != 0 && record->group != group) {
+    return false;
+  }
+
+  undo->current -= undo_read(undo, undo->current - length, record);
+  undo->open = false;
+  *pieces = undo->pieces;
+  return true;
+}
+
+bool undo_step_forward(Undo* undo, size_t group, Undo_Record* record,
+                       const Piece** pieces)
+{
+  if (undo->current == undo->tail) {
+    return false;
+  }
+
+  undo_ring_read(undo, undo->current, record, sizeof(*record));
+  if (group != 0 && record->group != group) {
+    return false;
+  }
+
+  undo->current += undo_read(undo, undo->current, record);
+  undo->open = false;
+  *pieces = undo->pieces;
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+#define UNDO_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+// One edit: the removed_size bytes at offset were replaced by
+// inserted_size bytes. Both sides are kept as the pieces of the table
+// that hold them instead of copies of the text, so undoing a paste of
+// any size costs as much as the one piece it was stored in. The pieces
+// follow the record in the log, removed ones first.
+typedef struct {
+  size_t offset;
+  size_t removed_size;
+  size_t removed_count;
+  size_t inserted_size;
+  size_t inserted_count;
+
+  // Records of one group are undone and redone together
+  size_t group;
+
+  // Cursor offset right before the edit
+  size_t cursor;
+} Undo_Record;
+
+// Append-only log of edits in a ring of budget bytes. Every record is
+// followed by its pieces and its own length, so the log can be walked
+// both ways. Positions count bytes since the log was created:
+// [head, current) can be undone and [current, tail) redone. The oldest
+// groups of records are dropped once the budget is exceeded.
+typedef struct {
+  size_t budget;
+  char* ring;
+  size_t head;
+  size_t current;
+  size_t tail;
+
+  size_t groups;
+  size_t group_depth;
+
+  // Group that did not fit in the budget; the rest of it is not logged
+  size_t dropped_group;
+
+  // Whether the newest record may absorb the next edit
+  bool open;
+
+  size_t pieces_capacity;
+  size_t pieces_size;
+  Piece* pieces;
+} Undo;
+
+void undo_set_budget(Undo* undo, size_t budget);
+void undo_clear(Undo* undo);
+void undo_free(Undo* undo);
+void undo_begin_group(Undo* undo);
+void undo_end_group(Undo* undo);
+void undo_seal(Undo* undo);
+
+const Piece* undo_collect(Undo* undo, const Piece_Table* pt, size_t offset,
+                          size_t count, size_t* pieces_count);
+void undo_push(Undo* undo, const Undo_Record* record, const Piece* removed,
+               const Piece* inserted);
+bool undo_step_back(Undo* undo, size_t group, Undo_Record* record,
+                    const Piece** pieces);
+bool undo_step_forward(Undo* undo, size_t group, Undo_Record* record,
+                       const Piece** pieces);
+
+#endif  // UNDO_H_
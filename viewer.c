@@ -0,0 +1,397 @@
+#include "./viewer.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void viewer_push_checkpoint(Viewer* viewer, size_t offset)
+{
+  if (viewer->checkpoints_size >= viewer->checkpoints_capacity) {
+    viewer->checkpoints_capacity = viewer->checkpoints_capacity == 0
+                                       ? 1024
+                                       : viewer->checkpoints_capacity * 2;
+    viewer->checkpoints =
+        realloc(viewer->checkpoints, viewer->checkpoints_capacity *
+                                         sizeof(viewer->checkpoints[0]));
+  }
+  viewer->checkpoints[viewer->checkpoints_size++] = offset;
+}
+
+// Counts the lines of the file once, front to back. Scanned blocks are
+// dropped from the page cache so that a file larger than memory does not
+// push everything else out of it.
+static void* viewer_run(void* arg)
+{
+  Viewer* viewer = arg;
+  char* block = malloc(VIEWER_SCAN_BLOCK);
+  size_t offset = 0;
+  size_t lines = 0;
+  posix_fadvise(viewer->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  while (offset < viewer->size) {
+    size_t n = viewer->size - offset;
+    if (n > VIEWER_SCAN_BLOCK) {
+      n = VIEWER_SCAN_BLOCK;
+    }
+    const ssize_t got = pread(viewer->fd, block, n, (off_t)offset);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    n = (size_t)got;
+
+    pthread_mutex_lock(&viewer->mutex);
+    const char* p = block;
+    const char* end = block + n;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+      p += 1;
+      lines += 1;
+      if (lines % VIEWER_CHECKPOINT_LINES == 0) {
+        viewer_push_checkpoint(viewer, offset + (size_t)(p - block));
+      }
+    }
+    offset += n;
+    viewer->scanned = offset;
+    viewer->lines = lines;
+    const bool cancel = viewer->cancel;
+    pthread_mutex_unlock(&viewer->mutex);
+
+    posix_fadvise(viewer->fd, (off_t)(offset - n), (off_t)n,
+                  POSIX_FADV_DONTNEED);
+    if (cancel) {
+      break;
+    }
+  }
+  free(block);
+
+  pthread_mutex_lock(&viewer->mutex);
+  viewer->done = true;
+  pthread_mutex_unlock(&viewer->mutex);
+  return NULL;
+}
+
+bool viewer_open(Viewer* viewer, const char* file_path)
+{
+  memset(viewer, 0, sizeof(*viewer));
+  viewer->fd = open(file_path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (viewer->fd < 0) {
+    return false;
+  }
+  if (fstat(viewer->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    close(viewer->fd);
+    return false;
+  }
+  viewer->size = (size_t)st.st_size;
+  viewer_push_checkpoint(viewer, 0);
+  viewer->top_row_known = true;
+  viewer->text = malloc(VIEWER_MAX_ROWS * VIEWER_LINE_MAX);
+  viewer->shown_top = SIZE_MAX;
+
+  pthread_mutex_init(&viewer->mutex, NULL);
+  if (pthread_create(&viewer->thread, NULL, viewer_run, viewer) != 0) {
+    pthread_mutex_destroy(&viewer->mutex);
+    close(viewer->fd);
+    free(viewer->checkpoints);
+    free(viewer->text);
+    return false;
+  }
+  viewer->running = true;
+  return true;
+}
+
+void viewer_close(Viewer* viewer)
+{
+  if (!viewer->running) {
+    return;
+  }
+  pthread_mutex_lock(&viewer->mutex);
+  viewer->cancel = true;
+  pthread_mutex_unlock(&viewer->mutex);
+  pthread_join(viewer->thread, NULL);
+  pthread_mutex_destroy(&viewer->mutex);
+
+  if (viewer->window != NULL) {
+    munmap(viewer->window, viewer->window_size);
+  }
+  close(viewer->fd);
+  free(viewer->checkpoints);
+  free(viewer->text);
+  memset(viewer, 0, sizeof(*viewer));
+}
+
+// Returns the byte at offset, mapping the window around it first if it
+// is outside of the current one. The window reaches back a little so
+// scrolling up does not move it right away.
+static const char* viewer_map(Viewer* viewer, size_t offset)
+{
+  if (viewer->window != NULL && offset >= viewer->window_begin &&
+      offset < viewer->window_begin + viewer->window_size) {
+    return viewer->window + (offset - viewer->window_begin);
+  }
+
+  if (viewer->window != NULL) {
+    munmap(viewer->window, viewer->window_size);
+    viewer->window = NULL;
+  }
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = offset > VIEWER_WINDOW_SIZE / 4
+                     ? offset - VIEWER_WINDOW_SIZE / 4
+                     : 0;
+  begin -= begin % page;
+  size_t size = viewer->size - begin;
+  if (size > VIEWER_WINDOW_SIZE) {
+    size = VIEWER_WINDOW_SIZE;
+  }
+
+  void* window =
+      mmap(NULL, size, PROT_READ, MAP_PRIVATE, viewer->fd, (off_t)begin);
+  if (window == MAP_FAILED) {
+    return NULL;
+  }
+  viewer->window = window;
+  viewer->window_begin = begin;
+  viewer->window_size = size;
+  return viewer->window + (offset - begin);
+}
+
+static size_t viewer_window_end(const Viewer* viewer)
+{
+  return viewer->window_begin + viewer->window_size;
+}
+
+// Offset of the line after the one at offset, or the size of the file
+static size_t viewer_next_line(Viewer* viewer, size_t offset)
+{
+  while (offset < viewer->size) {
+    const char* p = viewer_map(viewer, offset);
+    if (p == NULL) {
+      return viewer->size;
+    }
+    const size_t n = viewer_window_end(viewer) - offset;
+    const char* lf = memchr(p, '\n', n);
+    if (lf != NULL) {
+      return offset + (size_t)(lf - p) + 1;
+    }
+    offset += n;
+  }
+  return viewer->size;
+}
+
+// Offset where the line holding offset - 1 starts
+static size_t viewer_line_before(Viewer* viewer, size_t offset)
+{
+  offset -= 1;
+  while (offset > 0) {
+    const char* p = viewer_map(viewer, offset - 1);
+    if (p == NULL) {
+      return 0;
+    }
+    for (size_t i = (size_t)(p - viewer->window) + 1; i > 0; --i) {
+      if (viewer->window[i - 1] == '\n') {
+        return viewer->window_begin + i;
+      }
+    }
+    offset = viewer->window_begin;
+  }
+  return 0;
+}
+
+// Drops the pages of the window that [begin, end) does not touch
+static void viewer_keep_only(Viewer* viewer, size_t begin, size_t end)
+{
+  if (viewer->window == NULL) {
+    return;
+  }
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t window_end = viewer_window_end(viewer);
+  begin = begin < viewer->window_begin ? viewer->window_begin : begin;
+  end = end > window_end ? window_end : end;
+  if (begin > end) {
+    begin = end;
+  }
+  begin -= (begin - viewer->window_begin) % page;
+  end += (page - (end - viewer->window_begin) % page) % page;
+  if (end > window_end) {
+    end = window_end;
+  }
+
+  if (begin > viewer->window_begin) {
+    madvise(viewer->window, begin - viewer->window_begin, MADV_DONTNEED);
+  }
+  if (end < window_end) {
+    const size_t tail = end - viewer->window_begin;
+    madvise(viewer->window + tail, viewer->window_size - tail,
+            MADV_DONTNEED);
+  }
+}
+
+// Returns up to count lines from the top of the view, each cut to
+// VIEWER_LINE_MAX bytes. They stay valid until the view moves.
+size_t viewer_lines(Viewer* viewer, size_t count, const String_View** lines)
+{
+  if (count > VIEWER_MAX_ROWS) {
+    count = VIEWER_MAX_ROWS;
+  }
+  *lines = viewer->shown;
+  if (viewer->shown_top == viewer->top && viewer->shown_asked >= count) {
+    return viewer->shown_count < count ? viewer->shown_count : count;
+  }
+
+  size_t offset = viewer->top;
+  size_t shown = 0;
+  while (shown < count && offset < viewer->size) {
+    char* text = viewer->text + shown * VIEWER_LINE_MAX;
+    size_t size = 0;
+    size_t at = offset;
+    bool eol = false;
+    while (size < VIEWER_LINE_MAX && at < viewer->size) {
+      const char* p = viewer_map(viewer, at);
+      if (p == NULL) {
+        break;
+      }
+      size_t n = viewer_window_end(viewer) - at;
+      if (n > VIEWER_LINE_MAX - size) {
+        n = VIEWER_LINE_MAX - size;
+      }
+      const char* lf = memchr(p, '\n', n);
+      const size_t m = lf != NULL ? (size_t)(lf - p) : n;
+      memcpy(text + size, p, m);
+      size += m;
+      at += m;
+      if (lf != NULL) {
+        eol = true;
+        break;
+      }
+    }
+
+    viewer->shown[shown++] = (String_View){.count = size, .data = text};
+    offset = eol ? at + 1 : viewer_next_line(viewer, at);
+  }
+
+  viewer_keep_only(viewer, viewer->top, offset);
+  viewer->shown_top = viewer->top;
+  viewer->shown_asked = count;
+  viewer->shown_count = shown;
+  return shown;
+}
+
+void viewer_scroll(Viewer* viewer, long delta)
+{
+  for (; delta > 0; --delta) {
+    const size_t next = viewer_next_line(viewer, viewer->top);
+    if (next >= viewer->size) {
+      break;
+    }
+    viewer->top = next;
+    viewer->top_row += 1;
+  }
+  for (; delta < 0 && viewer->top > 0; ++delta) {
+    viewer->top = viewer_line_before(viewer, viewer->top);
+    viewer->top_row -= 1;
+  }
+}
+
+// Starts from the nearest checkpoint at or before row that the scan has
+// reached, so at most VIEWER_CHECKPOINT_LINES lines are skipped over
+void viewer_goto_line(Viewer* viewer, size_t row)
+{
+  pthread_mutex_lock(&viewer->mutex);
+  size_t checkpoint = row / VIEWER_CHECKPOINT_LINES;
+  if (checkpoint >= viewer->checkpoints_size) {
+    // Past what the scan has reached: stop near where it is
+    checkpoint = viewer->checkpoints_size - 1;
+    if (!viewer->done) {
+      row = checkpoint * VIEWER_CHECKPOINT_LINES +
+            (viewer->lines % VIEWER_CHECKPOINT_LINES);
+    }
+  }
+  viewer->top = viewer->checkpoints[checkpoint];
+  pthread_mutex_unlock(&viewer->mutex);
+
+  viewer->top_row = checkpoint * VIEWER_CHECKPOINT_LINES;
+  viewer->top_row_known = true;
+  viewer_scroll(viewer, (long)(row - viewer->top_row));
+}
+
+// The line is found right away; its number only once the scan gets
+// there, see viewer_top_row()
+void viewer_goto_percent(Viewer* viewer, double percent)
+{
+  if (percent < 0.0) {
+    percent = 0.0;
+  }
+  size_t offset = (size_t)((double)viewer->size * percent / 100.0);
+  if (offset >= viewer->size) {
+    offset = viewer->size > 0 ? viewer->size - 1 : 0;
+  }
+  viewer->top = offset > 0 ? viewer_line_before(viewer, offset + 1) : 0;
+  viewer->top_row_known = viewer->top == 0;
+  viewer->top_row = 0;
+}
+
+void viewer_goto_end(Viewer* viewer)
+{
+  viewer_goto_percent(viewer, 100.0);
+}
+
+// Number of the top line, counted from the checkpoint before it. Returns
+// false while the scan has not reached it yet.
+bool viewer_top_row(Viewer* viewer, size_t* row)
+{
+  if (viewer->top_row_known) {
+    *row = viewer->top_row;
+    return true;
+  }
+
+  pthread_mutex_lock(&viewer->mutex);
+  const bool reached = viewer->done || viewer->top < viewer->scanned;
+  size_t lo = 0;
+  size_t hi = viewer->checkpoints_size;
+  while (hi - lo > 1) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (viewer->checkpoints[mid] <= viewer->top) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  size_t offset = viewer->checkpoints[lo];
+  pthread_mutex_unlock(&viewer->mutex);
+  if (!reached) {
+    return false;
+  }
+
+  size_t counted = lo * VIEWER_CHECKPOINT_LINES;
+  while (offset < viewer->top) {
+    offset = viewer_next_line(viewer, offset);
+    counted += 1;
+  }
+  viewer->top_row = counted;
+  viewer->top_row_known = true;
+  *row = counted;
+  return true;
+}
+
+// Lines counted so far; returns true once that is all of them
+bool viewer_rows(Viewer* viewer, size_t* rows)
+{
+  pthread_mutex_lock(&viewer->mutex);
+  *rows = viewer->lines + 1;
+  const bool done = viewer->done;
+  pthread_mutex_unlock(&viewer->mutex);
+  return done;
+}
+
+float viewer_progress(Viewer* viewer)
+{
+  pthread_mutex_lock(&viewer->mutex);
+  const size_t scanned = viewer->scanned;
+  pthread_mutex_unlock(&viewer->mutex);
+  return viewer->size > 0 ? (float)scanned / (float)viewer->size : 1.0f;
+}
@@ -0,0 +1,68 @@
+#ifndef VIEWER_H_
+#define VIEWER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "sv.h"
+
+#define VIEWER_CHECKPOINT_LINES 4096
+#define VIEWER_WINDOW_SIZE (16 * 1024 * 1024)
+#define VIEWER_SCAN_BLOCK (4 * 1024 * 1024)
+#define VIEWER_LINE_MAX 1024
+#define VIEWER_MAX_ROWS 256
+
+// Read-only view of a file of any size. Only a window of the file is
+// mapped at a time, and of the window only the pages on screen are kept;
+// the rest is dropped with madvise() as the view moves. Lines are found
+// through a checkpoint every VIEWER_CHECKPOINT_LINES lines, which a
+// background thread collects in one pass over the file. So memory stays
+// bounded and a jump to any line only scans from the nearest checkpoint.
+typedef struct {
+  int fd;
+  size_t size;
+
+  char* window;
+  size_t window_begin;
+  size_t window_size;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  // Checkpoint i is the offset where line i * VIEWER_CHECKPOINT_LINES
+  // starts
+  size_t checkpoints_capacity;
+  size_t checkpoints_size;
+  size_t* checkpoints;
+  size_t scanned;
+  size_t lines;
+  bool done;
+  bool cancel;
+
+  // First line on screen and, once known, its number
+  size_t top;
+  size_t top_row;
+  bool top_row_known;
+
+  // Lines on screen, copied out of the window
+  size_t shown_top;
+  size_t shown_asked;
+  size_t shown_count;
+  String_View shown[VIEWER_MAX_ROWS];
+  char* text;
+} Viewer;
+
+bool viewer_open(Viewer* viewer, const char* file_path);
+void viewer_close(Viewer* viewer);
+
+size_t viewer_lines(Viewer* viewer, size_t count, const String_View** lines);
+void viewer_scroll(Viewer* viewer, long delta);
+void viewer_goto_line(Viewer* viewer, size_t row);
+void viewer_goto_percent(Viewer* viewer, double percent);
+void viewer_goto_end(Viewer* viewer);
+
+bool viewer_top_row(Viewer* viewer, size_t* row);
+bool viewer_rows(Viewer* viewer, size_t* rows);
+float viewer_progress(Viewer* viewer);
+
+#endif  // VIEWER_H_
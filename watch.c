@@ -0,0 +1,507 @@
+#include "./watch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_INIT_CHUNKS 256
+#define WATCH_READ_BLOCK (1024 * 1024)
+#define WATCH_FNV_OFFSET 0xcbf29ce484222325ULL
+#define WATCH_FNV_PRIME 0x100000001b3ULL
+
+static uint64_t watch_gear[256];
+static pthread_once_t watch_gear_once = PTHREAD_ONCE_INIT;
+
+// Random values for the rolling hash that finds chunk boundaries
+static void watch_gear_init(void)
+{
+  uint64_t x = 0x9e3779b97f4a7c15ULL;
+  for (size_t i = 0; i < 256; ++i) {
+    x += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    watch_gear[i] = z ^ (z >> 31);
+  }
+}
+
+static double watch_now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void watch_chunks_push(Watch_Chunks* chunks)
+{
+  if (chunks->size >= chunks->capacity) {
+    chunks->capacity = chunks->capacity == 0 ? WATCH_INIT_CHUNKS
+                                             : chunks->capacity * 2;
+    chunks->items = realloc(chunks->items,
+                            chunks->capacity * sizeof(chunks->items[0]));
+  }
+  chunks->items[chunks->size++] = (Watch_Chunk){
+      .hash = chunks->hash,
+      .size = chunks->length,
+  };
+  chunks->gear = 0;
+  chunks->hash = WATCH_FNV_OFFSET;
+  chunks->length = 0;
+}
+
+// Cuts the text into chunks where a rolling hash of the last bytes hits
+// a pattern, so an edit only changes the chunks around it and all the
+// others keep their hashes, even if they moved
+void watch_chunks_feed(Watch_Chunks* chunks, const char* data, size_t size)
+{
+  pthread_once(&watch_gear_once, watch_gear_init);
+  if (chunks->length == 0) {
+    chunks->hash = WATCH_FNV_OFFSET;
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    const unsigned char byte = (unsigned char)data[i];
+    chunks->gear = (chunks->gear << 1) + watch_gear[byte];
+    chunks->hash = (chunks->hash ^ byte) * WATCH_FNV_PRIME;
+    chunks->length += 1;
+    if ((chunks->length >= WATCH_CHUNK_MIN &&
+         (chunks->gear & WATCH_CHUNK_MASK) == 0) ||
+        chunks->length >= WATCH_CHUNK_MAX) {
+      watch_chunks_push(chunks);
+    }
+  }
+}
+
+void watch_chunks_finish(Watch_Chunks* chunks)
+{
+  if (chunks->length > 0) {
+    watch_chunks_push(chunks);
+  }
+}
+
+static Watch_Identity watch_identify(const struct stat* st)
+{
+  return (Watch_Identity){
+      .size = (size_t)st->st_size,
+      .mtime_sec = (int64_t)st->st_mtim.tv_sec,
+      .mtime_nsec = (int64_t)st->st_mtim.tv_nsec,
+      .inode = (uint64_t)st->st_ino,
+  };
+}
+
+static bool watch_same(const Watch_Identity* a, const Watch_Identity* b)
+{
+  return a->size == b->size && a->mtime_sec == b->mtime_sec &&
+         a->mtime_nsec == b->mtime_nsec && a->inode == b->inode;
+}
+
+static bool watch_stat(const char* file_path, Watch_Identity* identity)
+{
+  struct stat st;
+  if (stat(file_path, &st) < 0) {
+    memset(identity, 0, sizeof(*identity));
+    return false;
+  }
+  *identity = watch_identify(&st);
+  return true;
+}
+
+static void watch_hash_snapshot(Watch_Chunks* chunks,
+                                const Pt_Snapshot* snapshot)
+{
+  chunks->size = 0;
+  chunks->length = 0;
+  Pt_Iter it = pt_snapshot_iter(snapshot, 0, snapshot->size);
+  String_View chunk = {0};
+  while (pt_iter_next(&it, &chunk)) {
+    watch_chunks_feed(chunks, chunk.data, chunk.count);
+  }
+  watch_chunks_finish(chunks);
+}
+
+static bool watch_pread(int fd, char* data, size_t size, size_t offset)
+{
+  while (size > 0) {
+    const ssize_t n = pread(fd, data, size, (off_t)offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= (size_t)n;
+    offset += (size_t)n;
+  }
+  return true;
+}
+
+// Hashes the file as it is now and reads the part of it that differs
+// from the chunks of the text on disk before. The text never points into
+// a file that changed (see editor_poll_mapping()), so chunks that match
+// at either end are kept, whether the file was replaced or rewritten in
+// place.
+static void watch_compare(Watcher* watcher, const Watch_Chunks* disk,
+                          Watch_Chunks* now)
+{
+  watcher->unchanged = false;
+  watcher->retry = false;
+  memset(&watcher->change, 0, sizeof(watcher->change));
+
+  const int fd = open(watcher->file_path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    const int error = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    // Gone for now, it may be about to be renamed back into place
+    watcher->retry = error == ENOENT;
+    watcher->unchanged = !watcher->retry;
+    return;
+  }
+  const Watch_Identity identity = watch_identify(&st);
+
+  char* block = malloc(WATCH_READ_BLOCK);
+  now->size = 0;
+  now->length = 0;
+  size_t offset = 0;
+  bool ok = true;
+  while (ok && offset < identity.size) {
+    const size_t n = identity.size - offset < WATCH_READ_BLOCK
+                         ? identity.size - offset
+                         : WATCH_READ_BLOCK;
+    ok = watch_pread(fd, block, n, offset);
+    watch_chunks_feed(now, block, n);
+    offset += n;
+  }
+  watch_chunks_finish(now);
+  free(block);
+
+  size_t old_size = 0;
+  for (size_t i = 0; i < disk->size; ++i) {
+    old_size += disk->items[i].size;
+  }
+
+  size_t first = 0;
+  size_t begin = 0;
+  while (first < disk->size && first < now->size &&
+         disk->items[first].hash == now->items[first].hash &&
+         disk->items[first].size == now->items[first].size) {
+    begin += disk->items[first].size;
+    first += 1;
+  }
+
+  size_t last = 0;
+  size_t tail = 0;
+  while (first + last < disk->size && first + last < now->size &&
+         disk->items[disk->size - 1 - last].hash ==
+             now->items[now->size - 1 - last].hash &&
+         disk->items[disk->size - 1 - last].size ==
+             now->items[now->size - 1 - last].size) {
+    tail += disk->items[disk->size - 1 - last].size;
+    last += 1;
+  }
+
+  Watch_Change* change = &watcher->change;
+  change->begin = begin;
+  change->end = old_size - tail;
+  change->size = identity.size - tail - begin;
+  change->identity = identity;
+  if (ok && change->begin == change->end && change->size == 0) {
+    watcher->unchanged = true;
+  } else if (ok) {
+    change->data = malloc(change->size > 0 ? change->size : 1);
+    ok = watch_pread(fd, change->data, change->size, begin);
+  }
+
+  // Still being written: try again once it calms down
+  struct stat after;
+  if (ok && fstat(fd, &after) == 0) {
+    const Watch_Identity now_identity = watch_identify(&after);
+    ok = watch_same(&identity, &now_identity);
+  } else {
+    ok = false;
+  }
+  if (!ok) {
+    free(change->data);
+    change->data = NULL;
+    watcher->unchanged = false;
+    watcher->retry = true;
+  }
+  close(fd);
+}
+
+static void* watch_run(void* arg)
+{
+  Watcher* watcher = arg;
+  Watch_Chunks disk = {0};
+  Watch_Chunks now = {0};
+
+  pthread_mutex_lock(&watcher->mutex);
+  while (true) {
+    while (!watcher->stop && !(watcher->hashing && !watcher->hashed) &&
+           !(watcher->comparing && !watcher->compared)) {
+      pthread_cond_wait(&watcher->cond, &watcher->mutex);
+    }
+    if (watcher->stop) {
+      break;
+    }
+
+    if (watcher->hashing && !watcher->hashed) {
+      const Pt_Snapshot* snapshot = &watcher->hash_snapshot;
+      pthread_mutex_unlock(&watcher->mutex);
+      watch_hash_snapshot(&disk, snapshot);
+      pthread_mutex_lock(&watcher->mutex);
+      watcher->hashed = true;
+    } else {
+      pthread_mutex_unlock(&watcher->mutex);
+      watch_compare(watcher, &disk, &now);
+      pthread_mutex_lock(&watcher->mutex);
+      watcher->compared = true;
+    }
+  }
+  pthread_mutex_unlock(&watcher->mutex);
+
+  free(disk.items);
+  free(now.items);
+  return NULL;
+}
+
+bool watcher_start(Watcher* watcher, const char* file_path)
+{
+  memset(watcher, 0, sizeof(*watcher));
+  watcher->inotify = -1;
+  pthread_once(&watch_gear_once, watch_gear_init);
+
+  char* path = realpath(file_path, NULL);
+  if (path == NULL) {
+    return false;
+  }
+  const char* slash = strrchr(path, '/');
+  watcher->file_path = path;
+  watcher->name = strdup(slash + 1);
+  char* dir = strndup(path, slash == path ? 1 : (size_t)(slash - path));
+
+  // The directory is watched, not the file, so a file replaced by a
+  // rename keeps being noticed
+  watcher->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  const int wd = watcher->inotify < 0
+                     ? -1
+                     : inotify_add_watch(watcher->inotify, dir,
+                                         IN_CLOSE_WRITE | IN_MOVED_TO |
+                                             IN_CREATE | IN_MODIFY |
+                                             IN_DELETE);
+  free(dir);
+  if (wd < 0) {
+    if (watcher->inotify >= 0) {
+      close(watcher->inotify);
+    }
+    free(watcher->file_path);
+    free(watcher->name);
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->inotify = -1;
+    return false;
+  }
+
+  pthread_mutex_init(&watcher->mutex, NULL);
+  pthread_cond_init(&watcher->cond, NULL);
+  if (pthread_create(&watcher->thread, NULL, watch_run, watcher) != 0) {
+    pthread_mutex_destroy(&watcher->mutex);
+    pthread_cond_destroy(&watcher->cond);
+    close(watcher->inotify);
+    free(watcher->file_path);
+    free(watcher->name);
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->inotify = -1;
+    return false;
+  }
+  watcher->running = true;
+  return true;
+}
+
+static void watcher_set_snapshots(Watcher* watcher, Piece_Table* pt,
+                                  Pt_Snapshot* disk, Pt_Snapshot* hash)
+{
+  if (watcher->disk_known) {
+    pt_snapshot_release(pt, &watcher->disk_snapshot);
+  }
+  if (watcher->rehash) {
+    pt_snapshot_release(pt, &watcher->next_hash);
+  }
+  watcher->disk_snapshot = *disk;
+  watcher->next_hash = *hash;
+  watcher->rehash = true;
+  watcher->disk_known = true;
+  watch_stat(watcher->file_path, &watcher->disk);
+}
+
+// The text now matches the file on disk
+void watcher_set_disk(Watcher* watcher, Piece_Table* pt)
+{
+  if (!watcher->running) {
+    return;
+  }
+  Pt_Snapshot disk = pt_snapshot(pt);
+  Pt_Snapshot hash = pt_snapshot(pt);
+  watcher_set_snapshots(watcher, pt, &disk, &hash);
+}
+
+void watcher_begin_save(Watcher* watcher, Piece_Table* pt)
+{
+  if (!watcher->running) {
+    return;
+  }
+  watcher->saving_snapshots[0] = pt_snapshot(pt);
+  watcher->saving_snapshots[1] = pt_snapshot(pt);
+  watcher->saving = true;
+}
+
+void watcher_end_save(Watcher* watcher, Piece_Table* pt, bool saved)
+{
+  if (!watcher->saving) {
+    return;
+  }
+  watcher->saving = false;
+  if (saved) {
+    watcher_set_snapshots(watcher, pt, &watcher->saving_snapshots[0],
+                          &watcher->saving_snapshots[1]);
+    // Our own writes are not a change from outside
+    watcher->pending = false;
+  } else {
+    pt_snapshot_release(pt, &watcher->saving_snapshots[0]);
+    pt_snapshot_release(pt, &watcher->saving_snapshots[1]);
+  }
+}
+
+// Whether the text was edited since it was last loaded or saved
+bool watcher_modified(const Watcher* watcher, const Piece_Table* pt)
+{
+  return watcher->disk_known && pt->root != watcher->disk_snapshot.root;
+}
+
+static void watcher_read_events(Watcher* watcher)
+{
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (true) {
+    const ssize_t n = read(watcher->inotify, events, sizeof(events));
+    if (n <= 0) {
+      return;
+    }
+    for (ssize_t i = 0; i < n;) {
+      const struct inotify_event* event =
+          (const struct inotify_event*)(events + i);
+      if (event->len > 0 && strcmp(event->name, watcher->name) == 0) {
+        watcher->pending = true;
+        watcher->last_event = watch_now_seconds();
+      }
+      i += (ssize_t)(sizeof(*event) + event->len);
+    }
+  }
+}
+
+// Reports what the background thread found and starts its next job.
+// While busy, or when the text has edits of its own, a change on disk
+// is only reported, and the text is left as it is.
+Watch_Event watcher_poll(Watcher* watcher, Piece_Table* pt, bool busy,
+                         Watch_Change* change)
+{
+  if (!watcher->running) {
+    return WATCH_NONE;
+  }
+  Watch_Event event = WATCH_NONE;
+
+  pthread_mutex_lock(&watcher->mutex);
+  if (watcher->hashing && watcher->hashed) {
+    pt_snapshot_release(pt, &watcher->hash_snapshot);
+    watcher->hashing = false;
+    watcher->hashed = false;
+  }
+  if (watcher->rehash && !watcher->hashing && !watcher->comparing) {
+    watcher->hash_snapshot = watcher->next_hash;
+    watcher->rehash = false;
+    watcher->hashing = true;
+    pthread_cond_signal(&watcher->cond);
+  }
+  const bool compared = watcher->comparing && watcher->compared;
+  if (compared) {
+    watcher->comparing = false;
+    watcher->compared = false;
+  }
+  pthread_mutex_unlock(&watcher->mutex);
+
+  if (compared) {
+    if (watcher->unchanged) {
+      watcher->disk = watcher->change.identity;
+    } else if (watcher->retry || watcher->rehash) {
+      // Saved meanwhile, so compare again with what was saved
+      free(watcher->change.data);
+      watcher->pending = true;
+      watcher->last_event = watch_now_seconds();
+    } else if (busy || watcher_modified(watcher, pt)) {
+      free(watcher->change.data);
+      watcher->disk = watcher->change.identity;
+      event = WATCH_CHANGED;
+    } else {
+      *change = watcher->change;
+      event = WATCH_RELOAD;
+    }
+    memset(&watcher->change, 0, sizeof(watcher->change));
+  }
+
+  watcher_read_events(watcher);
+
+  if (event == WATCH_NONE && watcher->pending && !busy &&
+      !watcher->rehash && !watcher->hashing && !watcher->comparing &&
+      watch_now_seconds() - watcher->last_event >= WATCH_SETTLE_SECONDS) {
+    watcher->pending = false;
+    Watch_Identity identity;
+    if (watch_stat(watcher->file_path, &identity) &&
+        !watch_same(&identity, &watcher->disk)) {
+      pthread_mutex_lock(&watcher->mutex);
+      watcher->comparing = true;
+      pthread_cond_signal(&watcher->cond);
+      pthread_mutex_unlock(&watcher->mutex);
+    }
+  }
+  return event;
+}
+
+void watcher_stop(Watcher* watcher, Piece_Table* pt)
+{
+  if (!watcher->running) {
+    return;
+  }
+  pthread_mutex_lock(&watcher->mutex);
+  watcher->stop = true;
+  pthread_cond_signal(&watcher->cond);
+  pthread_mutex_unlock(&watcher->mutex);
+  pthread_join(watcher->thread, NULL);
+
+  if (watcher->hashing) {
+    pt_snapshot_release(pt, &watcher->hash_snapshot);
+  }
+  if (watcher->rehash) {
+    pt_snapshot_release(pt, &watcher->next_hash);
+  }
+  if (watcher->disk_known) {
+    pt_snapshot_release(pt, &watcher->disk_snapshot);
+  }
+  if (watcher->saving) {
+    pt_snapshot_release(pt, &watcher->saving_snapshots[0]);
+    pt_snapshot_release(pt, &watcher->saving_snapshots[1]);
+  }
+  free(watcher->change.data);
+  close(watcher->inotify);
+  pthread_mutex_destroy(&watcher->mutex);
+  pthread_cond_destroy(&watcher->cond);
+  free(watcher->file_path);
+  free(watcher->name);
+  memset(watcher, 0, sizeof(*watcher));
+  watcher->inotify = -1;
+}
@@ -0,0 +1,104 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "piece_table.h"
+
+// Chunks average 64 KB and break at the same content wherever it moved
+#define WATCH_CHUNK_MASK ((1u << 16) - 1)
+#define WATCH_CHUNK_MIN (16 * 1024)
+#define WATCH_CHUNK_MAX (256 * 1024)
+#define WATCH_SETTLE_SECONDS 0.2
+
+typedef struct {
+  size_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t inode;
+} Watch_Identity;
+
+typedef struct {
+  uint64_t hash;
+  size_t size;
+} Watch_Chunk;
+
+typedef struct {
+  size_t capacity;
+  size_t size;
+  Watch_Chunk* items;
+
+  // State of the chunk being hashed
+  uint64_t gear;
+  uint64_t hash;
+  size_t length;
+} Watch_Chunks;
+
+// What changed on disk: the bytes [begin, end) of the text as it was
+// loaded are now the size bytes of data
+typedef struct {
+  size_t begin;
+  size_t end;
+  char* data;
+  size_t size;
+  Watch_Identity identity;
+} Watch_Change;
+
+typedef enum {
+  WATCH_NONE,
+  WATCH_CHANGED,
+  WATCH_RELOAD,
+} Watch_Event;
+
+// Notices when another process writes the file. Once the events calm
+// down the file is compared with the text as it was last loaded or
+// saved, chunk by chunk, on a background thread that also keeps the
+// hashes of that text. Only the chunks in between the unchanged start
+// and end of the file are read back.
+typedef struct {
+  char* file_path;
+  char* name;
+  int inotify;
+  bool pending;
+  double last_event;
+
+  // The file as it is known to be on disk and the text it holds, with
+  // a second snapshot of that text waiting to be hashed
+  bool disk_known;
+  Watch_Identity disk;
+  Pt_Snapshot disk_snapshot;
+  bool rehash;
+  Pt_Snapshot next_hash;
+  bool saving;
+  Pt_Snapshot saving_snapshots[2];
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool hashing;
+  bool hashed;
+  Pt_Snapshot hash_snapshot;
+  bool comparing;
+  bool compared;
+  bool unchanged;
+  bool retry;
+  Watch_Change change;
+  bool stop;
+} Watcher;
+
+void watch_chunks_feed(Watch_Chunks* chunks, const char* data, size_t size);
+void watch_chunks_finish(Watch_Chunks* chunks);
+
+bool watcher_start(Watcher* watcher, const char* file_path);
+void watcher_set_disk(Watcher* watcher, Piece_Table* pt);
+void watcher_begin_save(Watcher* watcher, Piece_Table* pt);
+void watcher_end_save(Watcher* watcher, Piece_Table* pt, bool saved);
+bool watcher_modified(const Watcher* watcher, const Piece_Table* pt);
+Watch_Event watcher_poll(Watcher* watcher, Piece_Table* pt, bool busy,
+                         Watch_Change* change);
+void watcher_stop(Watcher* watcher, Piece_Table* pt);
+
+#endif  // WATCH_H_